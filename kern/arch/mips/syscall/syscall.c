@@ -112,6 +112,11 @@ void syscall(struct trapframe *tf)
 						 (userptr_t)tf->tf_a1);
 		break;
 
+	case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+							(userptr_t)tf->tf_a1);
+		break;
+
 	/* Add stuff here */
 	case SYS_open:
 		err = sys_open((const_userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2, &retval);
@@ -141,6 +146,39 @@ void syscall(struct trapframe *tf)
 		break;
 	}
 
+	case SYS_readv:
+		err = sys_readv(tf->tf_a0, (const_userptr_t)tf->tf_a1, tf->tf_a2, &retval);
+		break;
+
+	case SYS_writev:
+		err = sys_writev(tf->tf_a0, (const_userptr_t)tf->tf_a1, tf->tf_a2, &retval);
+		break;
+
+	case SYS_copy_file_range:
+		err = sys_copy_file_range(tf->tf_a0, tf->tf_a1, tf->tf_a2, &retval);
+		break;
+
+	case SYS_pread:
+	case SYS_pwrite:
+	{
+		/* The 64-bit offset is aligned past a3, onto the stack. */
+		off_t offset;
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &offset, sizeof(off_t));
+		if (err)
+		{
+			break;
+		}
+		if (callno == SYS_pread)
+		{
+			err = sys_pread(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, offset, &retval);
+		}
+		else
+		{
+			err = sys_pwrite(tf->tf_a0, (const_userptr_t)tf->tf_a1, tf->tf_a2, offset, &retval);
+		}
+		break;
+	}
+
 	case SYS_dup2:
 		err = sys_dup2(tf->tf_a0, tf->tf_a1, &retval);
 		break;
@@ -173,6 +211,33 @@ void syscall(struct trapframe *tf)
 		err = sys_execv((const_userptr_t)tf->tf_a0, (userptr_t *)tf->tf_a1);
 		break;
 
+	case SYS_sbrk:
+		err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
+		break;
+
+	case SYS_mmap:
+	{
+		int fd;
+		off_t offset;
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &fd, sizeof(int));
+		if (err)
+		{
+			break;
+		}
+		err = copyin((const_userptr_t)(tf->tf_sp + 24), &offset, sizeof(off_t));
+		if (err)
+		{
+			break;
+		}
+		err = sys_mmap((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3,
+					   fd, offset, &retval);
+		break;
+	}
+
+	case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0, tf->tf_a1);
+		break;
+
 	default:
 		kprintf("Unknown syscall %d\n", callno);
 		err = ENOSYS;
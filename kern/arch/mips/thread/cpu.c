@@ -288,6 +288,18 @@ cpu_idle(void)
         cpu_irqonoff();
 }
 
+/*
+ * Read the cycle counter. ($9 == c0_count.)
+ */
+uint32_t
+cpu_cycles(void)
+{
+	uint32_t count;
+
+	__asm volatile("mfc0 %0,$9" : "=r" (count));
+	return count;
+}
+
 /*
  * Halt the CPU permanently.
  */
@@ -37,6 +37,7 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -58,29 +59,21 @@
 /* (this must be > 64K so argument blocks of size ARG_MAX will fit) */
 #define DUMBVM_STACKPAGES    18
 
-/*
- * Wrap ram_stealmem in a spinlock.
- */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
-
 void
 vm_bootstrap(void)
 {
-	/* Do nothing. */
+	coremap_bootstrap();
 }
 
+/*
+ * Get physical pages from the coremap. OWNER is the address space the
+ * pages are for, or NULL for kernel pages.
+ */
 static
 paddr_t
-getppages(unsigned long npages)
+getppages(unsigned long npages, struct addrspace *owner)
 {
-	paddr_t addr;
-
-	spinlock_acquire(&stealmem_lock);
-
-	addr = ram_stealmem(npages);
-
-	spinlock_release(&stealmem_lock);
-	return addr;
+	return coremap_getppages(npages, owner);
 }
 
 /* Allocate/free some kernel-space virtual pages */
@@ -88,7 +81,7 @@ vaddr_t
 alloc_kpages(unsigned npages)
 {
 	paddr_t pa;
-	pa = getppages(npages);
+	pa = getppages(npages, NULL);
 	if (pa==0) {
 		return 0;
 	}
@@ -98,9 +91,7 @@ alloc_kpages(unsigned npages)
 void
 free_kpages(vaddr_t addr)
 {
-	/* nothing - leak the memory. */
-
-	(void)addr;
+	coremap_freeppages(KVADDR_TO_PADDR(addr));
 }
 
 void
@@ -199,22 +190,20 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
-		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
+	ehi = faultaddress;
+	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
+
+	/* Replace any existing entry; otherwise let the hardware pick. */
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
 		tlb_write(ehi, elo, i);
-		splx(spl);
-		return 0;
 	}
-
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
+	else {
+		tlb_random(ehi, elo);
+	}
 	splx(spl);
-	return EFAULT;
+	return 0;
 }
 
 struct addrspace *
@@ -239,6 +228,15 @@ as_create(void)
 void
 as_destroy(struct addrspace *as)
 {
+	if (as->as_pbase1 != 0) {
+		coremap_freeppages(as->as_pbase1);
+	}
+	if (as->as_pbase2 != 0) {
+		coremap_freeppages(as->as_pbase2);
+	}
+	if (as->as_stackpbase != 0) {
+		coremap_freeppages(as->as_stackpbase);
+	}
 	kfree(as);
 }
 
@@ -322,17 +320,17 @@ as_prepare_load(struct addrspace *as)
 	KASSERT(as->as_pbase2 == 0);
 	KASSERT(as->as_stackpbase == 0);
 
-	as->as_pbase1 = getppages(as->as_npages1);
+	as->as_pbase1 = getppages(as->as_npages1, as);
 	if (as->as_pbase1 == 0) {
 		return ENOMEM;
 	}
 
-	as->as_pbase2 = getppages(as->as_npages2);
+	as->as_pbase2 = getppages(as->as_npages2, as);
 	if (as->as_pbase2 == 0) {
 		return ENOMEM;
 	}
 
-	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
+	as->as_stackpbase = getppages(DUMBVM_STACKPAGES, as);
 	if (as->as_stackpbase == 0) {
 		return ENOMEM;
 	}
@@ -360,6 +358,40 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	/* dumbvm has no heap. */
+	(void)as;
+	(void)amount;
+	(void)oldbreak;
+	return ENOSYS;
+}
+
+int
+as_mmap(struct addrspace *as, size_t len, int perms, struct vnode *vn,
+	off_t offset, int mapflags, vaddr_t *ret)
+{
+	/* ...or mmap. */
+	(void)as;
+	(void)len;
+	(void)perms;
+	(void)vn;
+	(void)offset;
+	(void)mapflags;
+	(void)ret;
+	return ENOSYS;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	(void)as;
+	(void)addr;
+	(void)len;
+	return ENOSYS;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
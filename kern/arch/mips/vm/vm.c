@@ -0,0 +1,414 @@
+/*
+ * MIPS VM system: kernel page allocation, TLB management, and the
+ * page fault handler. Used whenever dumbvm is not configured.
+ *
+ * Physical pages come from the coremap. User pages are described by
+ * each address space's regions and page table; a page that is inside
+ * a region but has no page table entry yet is allocated and zeroed
+ * on the first fault that touches it, or, in a mapped file, found in
+ * the page cache. After fork, pages are shared between parent and
+ * child with PTE_COW set and are mapped read-only; the first write to
+ * one copies it (unless nobody else is left sharing it, in which case
+ * it is simply made writable again). Pages of MAP_SHARED file mappings
+ * start out read-only too; the first write to one marks it PTE_DIRTY,
+ * which is what decides whether it is written back to the file. Pages
+ * pushed out to swap by the coremap are read back on the next fault.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagecache.h>
+#include <vm.h>
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+	swap_bootstrap();
+	pagecache_bootstrap();
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+
+	pa = coremap_getppages(npages, NULL);
+	if (pa == 0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	coremap_freeppages(KVADDR_TO_PADDR(addr));
+}
+
+/*
+ * Invalidate the whole TLB on this CPU.
+ */
+void
+vm_tlbflush(void)
+{
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
+}
+
+/*
+ * Invalidate the TLB entry for VADDR on this CPU, if there is one.
+ */
+void
+vm_tlbinvalidate(vaddr_t vaddr)
+{
+	int i, spl;
+
+	spl = splhigh();
+	i = tlb_probe(vaddr & TLBHI_VPAGE, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
+}
+
+void
+vm_tlbshootdown_all(void)
+{
+	vm_tlbflush();
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	vm_tlbinvalidate(ts->ts_vaddr);
+}
+
+/*
+ * Remove the mappings for NPAGES pages starting at VADDR from every
+ * CPU's TLB, waiting until they are gone. Ranges too big to be worth
+ * doing page by page become a full flush.
+ */
+void
+vm_shootdown(vaddr_t vaddr, unsigned npages)
+{
+	struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+	unsigned i;
+
+	if (npages > TLBSHOOTDOWN_MAX) {
+		ipi_tlbshootdown_wait(NULL, npages);
+		return;
+	}
+	for (i = 0; i < npages; i++) {
+		ts[i].ts_vaddr = vaddr + i * PAGE_SIZE;
+	}
+	ipi_tlbshootdown_wait(ts, npages);
+}
+
+/*
+ * Load a translation into the TLB, replacing any existing entry for
+ * the same page. The MIPS random register picks the victim otherwise,
+ * which never touches the wired entries and costs nothing to compute.
+ */
+static
+void
+vm_tlbload(uint32_t ehi, uint32_t elo)
+{
+	int i, spl;
+
+	spl = splhigh();
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+	}
+	else {
+		tlb_random(ehi, elo);
+	}
+	splx(spl);
+}
+
+/*
+ * Load the resident page PTE for VA into the TLB, read-only if it is
+ * copy-on-write, a shared file page not yet written through this
+ * mapping, or WRITEABLE is false. Must be called with
+ * coremap_lock held; the TLB has to be loaded before letting go of
+ * it, or we could race with the evictor's shootdown and leave a stale
+ * entry behind.
+ */
+static
+void
+vm_tlbmap(struct addrspace *as, pte_t pte, vaddr_t va, bool writeable)
+{
+	paddr_t pa;
+	uint32_t elo;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT((pte & (PTE_PRESENT | PTE_BUSY)) == PTE_PRESENT);
+
+	pa = pte & PTE_FRAME;
+	coremap_touch(pa, as);
+
+	elo = pa | TLBLO_VALID;
+	if (writeable && !(pte & PTE_COW) &&
+	    (pte & (PTE_SHARED | PTE_DIRTY)) != PTE_SHARED) {
+		elo |= TLBLO_DIRTY;
+	}
+	vm_tlbload(va, elo);
+}
+
+/*
+ * TLB miss fast path: if the page is resident and the access needs no
+ * further work, load it without taking the (sleeping) address space
+ * lock. Returns false if the slow path has to handle it, including
+ * for anything that would be an error.
+ *
+ * Walking the region list and the page table unlocked is safe because
+ * processes are single-threaded: only this thread changes its own
+ * regions, and second-level tables are published with a barrier and
+ * freed only when the address space is destroyed. The entry itself is
+ * checked under coremap_lock like everywhere else.
+ */
+static
+bool
+vm_fastfault(struct addrspace *as, vaddr_t va, int faulttype)
+{
+	struct region *rg;
+	pte_t *pte, cur;
+	bool write, writeable;
+
+	if (as->as_loading) {
+		return false;
+	}
+	rg = as_findregion(as, va);
+	if (rg == NULL) {
+		return false;
+	}
+	write = faulttype != VM_FAULT_READ;
+	writeable = (rg->rg_perms & RG_WRITE) != 0;
+	if (write && !writeable) {
+		return false;
+	}
+	pte = pt_lookup(as->as_pt, va, false);
+	if (pte == NULL || (*pte & PTE_PRESENT) == 0) {
+		return false;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	cur = *pte;
+	if ((cur & (PTE_PRESENT | PTE_BUSY)) != PTE_PRESENT ||
+	    (write && (cur & PTE_COW))) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	if (write && (cur & PTE_SHARED)) {
+		/* First write to a shared file page through here. */
+		*pte |= PTE_DIRTY;
+		cur = *pte;
+	}
+	vm_tlbmap(as, cur, va, writeable);
+	spinlock_release(&coremap_lock);
+	return true;
+}
+
+/*
+ * Make the page PTE (for VA, in region RG) refers to resident and
+ * private enough for the access, and load it into the TLB. Must be
+ * called with the address space lock held. WRITE is true for write
+ * faults; WRITEABLE says whether the page may be mapped writable at all.
+ *
+ * Getting a new page may sleep (and evict), so each time we have had
+ * to drop coremap_lock we go around and look at the entry afresh.
+ */
+static
+int
+vm_pagein(struct addrspace *as, struct region *rg, pte_t *pte, vaddr_t va,
+	  bool write, bool writeable)
+{
+	pte_t old;
+	paddr_t pa, newpa;
+	int result;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	for (;;) {
+		spinlock_acquire(&coremap_lock);
+		while (*pte & PTE_BUSY) {
+			coremap_wait();
+		}
+		old = *pte;
+		pa = old & PTE_FRAME;
+
+		if (old & PTE_PRESENT) {
+			if ((old & PTE_COW) && write &&
+			    coremap_refcount(pa) == 1) {
+				/* Everyone else already copied or left. */
+				*pte &= ~PTE_COW;
+				old = *pte;
+			}
+			if ((old & PTE_SHARED) && write) {
+				*pte |= PTE_DIRTY;
+				old = *pte;
+			}
+			if (!(old & PTE_COW) || !write) {
+				vm_tlbmap(as, old, va, writeable);
+				spinlock_release(&coremap_lock);
+				return 0;
+			}
+			/* Shared copy-on-write; pin it while we copy. */
+			coremap_share(pa);
+		}
+		spinlock_release(&coremap_lock);
+
+		if (old == 0 && rg->rg_vnode != NULL) {
+			/* First touch of a mapped file page. */
+			result = pagecache_get(rg->rg_vnode,
+					       rg->rg_offset + (va - rg->rg_base),
+					       &newpa);
+			if (result) {
+				return result;
+			}
+			spinlock_acquire(&coremap_lock);
+			KASSERT(*pte == 0);
+			*pte = newpa | PTE_PRESENT |
+				((rg->rg_mapflags & MAP_SHARED) ?
+				 PTE_SHARED : PTE_COW);
+			spinlock_release(&coremap_lock);
+			continue;
+		}
+
+		newpa = coremap_getupage(as, va);
+		if (newpa == 0) {
+			result = ENOMEM;
+		}
+		else if (old & PTE_PRESENT) {
+			memmove((void *)PADDR_TO_KVADDR(newpa),
+				(const void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+			result = 0;
+		}
+		else if (old & PTE_SWAPPED) {
+			result = swap_in(PTE_SLOT(old), newpa);
+		}
+		else {
+			/* First touch: demand-zero. */
+			bzero((void *)PADDR_TO_KVADDR(newpa), PAGE_SIZE);
+			result = 0;
+		}
+
+		spinlock_acquire(&coremap_lock);
+		/* Only we change non-present entries, and PA is pinned. */
+		KASSERT(*pte == old);
+		if (newpa != 0) {
+			coremap_unbusy(newpa);
+		}
+		if (result) {
+			if (newpa != 0) {
+				coremap_freeupage(newpa, as);
+			}
+			if (old & PTE_PRESENT) {
+				coremap_freeupage(pa, as);
+			}
+			spinlock_release(&coremap_lock);
+			return result;
+		}
+		*pte = newpa | PTE_PRESENT;
+		if (old & PTE_PRESENT) {
+			/* Our mapping's reference, and the pin. */
+			coremap_freeupage(pa, as);
+			coremap_freeupage(pa, as);
+		}
+		spinlock_release(&coremap_lock);
+
+		if (old & PTE_SWAPPED) {
+			swap_free(PTE_SLOT(old));
+		}
+	}
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct region *rg;
+	pte_t *pte;
+	bool writeable;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	if (vm_fastfault(as, faultaddress, faulttype)) {
+		return 0;
+	}
+
+	lock_acquire(as->as_lock);
+
+	rg = as_findregion(as, faultaddress);
+	if (rg == NULL) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+	writeable = (rg->rg_perms & RG_WRITE) || as->as_loading;
+	if (faulttype != VM_FAULT_READ && !writeable) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	result = vm_pagein(as, rg, pte, faultaddress,
+			   faulttype != VM_FAULT_READ, writeable);
+
+	lock_release(as->as_lock);
+	return result;
+}
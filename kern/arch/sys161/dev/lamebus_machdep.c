@@ -75,6 +75,30 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Restart the on-chip timer from zero, so it goes off COUNT cycles
+ * from now wherever c0_count had got to. ($9 == c0_count.)
+ */
+static
+void
+mips_timer_restart(uint32_t count)
+{
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mtc0 $0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		);
+	mips_timer_set(count);
+}
+
+/*
+ * Compare value that puts the next timer interrupt as far off as it
+ * goes (about three minutes at 25 MHz). Used to stop hardclock on
+ * idle cpus.
+ */
+#define MIPS_TIMER_IDLE 0xffffffff
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -304,12 +328,28 @@ mainbus_interrupt(struct trapframe *tf)
 		seen = true;
 	}
 	if (cause & MIPS_TIMER_BIT) {
-		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
-		/* and call hardclock */
-		hardclock();
+		if (curcpu->c_isidle) {
+			/*
+			 * Tickless idle: hardclock has nothing to do on
+			 * an idle cpu, so just stop ticking. Anything
+			 * that could give us work comes in as one of the
+			 * other interrupts, and starts the ticks again
+			 * below.
+			 */
+			mips_timer_set(MIPS_TIMER_IDLE);
+		}
+		else {
+			/* Reset the timer (this clears the interrupt) */
+			mips_timer_set(CPU_FREQUENCY / HZ);
+			/* and call hardclock */
+			hardclock();
+		}
 		seen = true;
 	}
+	if (curcpu->c_isidle && (cause & (LAMEBUS_IRQ_BIT|LAMEBUS_IPI_BIT))) {
+		/* We might be about to unidle; tick again. */
+		mips_timer_restart(CPU_FREQUENCY / HZ);
+	}
 
 	if (!seen) {
 		if ((cause & CCA_IRQS) == 0) {
@@ -51,6 +51,19 @@
 
 static bool havetimerclock;
 
+/*
+ * Start the countdown timer: interrupt once, USECS microseconds from
+ * now. Called from timerclock code.
+ */
+static
+void
+ltimer_arm(void *vlt, uint32_t usecs)
+{
+	struct ltimer_softc *lt = vlt;
+
+	bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT, usecs);
+}
+
 /*
  * Setup routine called by autoconf stuff when an ltimer is found.
  */
@@ -85,16 +98,15 @@ config_ltimer(struct ltimer_softc *lt, int ltimerno)
 
 	/*
 	 * We do, however, use ltimer for the timer clock, since the
-	 * on-chip timer can't do that.
+	 * on-chip timer can't do that. It runs one-shot: each time it
+	 * goes off, timerclock sets it for the next timeout or second.
 	 */
 	if (!havetimerclock) {
 		havetimerclock = true;
 		lt->lt_timerclock = 1;
 
-		/* Wire it to go off once every second. */
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 1);
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
-				   LT_GRANULARITY);
+		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 0);
+		timerclock_attach(ltimer_arm, lt);
 	}
 
 	return 0;
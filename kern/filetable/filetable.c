@@ -6,17 +6,114 @@
 #include <vfs.h>
 #include <kern/fcntl.h>
 #include <kern/unistd.h>
+#include <kmem.h>
 #include <filetable.h>
 
+/* File handles come from an object cache; a free one keeps its lock. */
+static struct kmem_cache *filehandle_cache;
+
+static int filehandle_ctor(void *obj)
+{
+    struct filehandle *fh = obj;
+
+    fh->fh_lock = lock_create("file_handle_lock");
+    if (fh->fh_lock == NULL)
+    {
+        return ENOMEM;
+    }
+    spinlock_init(&fh->fh_reflock);
+    return 0;
+}
+
+static void filehandle_dtor(void *obj)
+{
+    struct filehandle *fh = obj;
+
+    spinlock_cleanup(&fh->fh_reflock);
+    lock_destroy(fh->fh_lock);
+}
+
+/**
+ * @brief Set up the file handle cache. Called once during system startup.
+ */
+void filetable_bootstrap(void)
+{
+    filehandle_cache = kmem_cache_create("filehandle", sizeof(struct filehandle),
+                                         filehandle_ctor, filehandle_dtor);
+    if (filehandle_cache == NULL)
+    {
+        panic("filetable_bootstrap: Out of memory\n");
+    }
+}
+
 //////////////////////////////////////////////////
 //
 // File descriptor table functions
 
+/*
+ * Make room for at least NSLOTS slots, doubling the table as many times
+ * as needed. Must be called with the table locked.
+ * Returns 0 or ENOMEM; NSLOTS must not be more than OPEN_MAX.
+ */
+static int ft_grow(struct filetable *ft, unsigned nslots)
+{
+    struct filehandle **handles;
+    struct bitmap *used;
+    unsigned size, i;
+
+    KASSERT(nslots <= OPEN_MAX);
+
+    if (nslots <= ft->ft_size)
+    {
+        return 0;
+    }
+    for (size = ft->ft_size; size < nslots; size *= 2)
+    {
+        /* nothing */
+    }
+    if (size > OPEN_MAX)
+    {
+        size = OPEN_MAX;
+    }
+
+    handles = kmalloc(size * sizeof(handles[0]));
+    if (handles == NULL)
+    {
+        return ENOMEM;
+    }
+    used = bitmap_create(size);
+    if (used == NULL)
+    {
+        kfree(handles);
+        return ENOMEM;
+    }
+
+    memcpy(handles, ft->file_handles, ft->ft_size * sizeof(handles[0]));
+    bzero(handles + ft->ft_size, (size - ft->ft_size) * sizeof(handles[0]));
+    for (i = 0; i < ft->ft_size; i++)
+    {
+        if (handles[i] != NULL)
+        {
+            bitmap_mark(used, i);
+        }
+    }
+
+    if (ft->file_handles != ft->ft_small)
+    {
+        kfree(ft->file_handles);
+    }
+    bitmap_destroy(ft->ft_used);
+    ft->file_handles = handles;
+    ft->ft_used = used;
+    ft->ft_size = size;
+    return 0;
+}
+
 /**
  * @brief Create a new file descriptor table.
  *
  * This function allocates memory for a new file descriptor table and initializes it by creating a lock
- * for synchronization. It also initializes the file handles array with standard I/O.
+ * for synchronization. The table starts out empty, using the slots built into the structure.
  *
  * @return A pointer to the newly created file descriptor table, 
  * or NULL if memory allocation fails or if the lock creation fails.
@@ -37,11 +134,20 @@ filetable_create(void)
         return NULL;
     }
 
-    for (int i = 0; i < OPEN_MAX; i++)
+    ft->ft_used = bitmap_create(FT_NSMALL);
+    if (ft->ft_used == NULL)
     {
-        ft->file_handles[i] = NULL;
+        lock_destroy(ft->ft_lock);
+        kfree(ft);
+        return NULL;
     }
 
+    ft->ft_refcount = 1;
+    spinlock_init(&ft->ft_reflock);
+    ft->file_handles = ft->ft_small;
+    ft->ft_size = FT_NSMALL;
+    bzero(ft->ft_small, sizeof(ft->ft_small));
+
     return ft;
 }
 
@@ -65,19 +171,31 @@ void filetable_stdio_init(struct filetable *ft) {
 }
 
 /**
- * @brief Destroy the file descriptor table.
+ * @brief Drop a reference to the file descriptor table, destroying it if it was the last.
  * 
- * This function releases all file handles in the file descriptor table by decrementing their reference counts
+ * Destroying the table releases all file handles in it by decrementing their reference counts
  * and setting them to NULL. It also destroys the lock associated with the file descriptor table and frees the memory.
  * 
  * @param ft The file descriptor table to be destroyed.
  */
 void filetable_destroy(struct filetable *ft)
 {
+    unsigned refcount;
+
     KASSERT(ft != NULL);
 
+    spinlock_acquire(&ft->ft_reflock);
+    KASSERT(ft->ft_refcount > 0);
+    refcount = --ft->ft_refcount;
+    spinlock_release(&ft->ft_reflock);
+    if (refcount > 0)
+    {
+        // Still in use by another process
+        return;
+    }
+
     lock_acquire(ft->ft_lock);
-    for (int i = 0; i < OPEN_MAX; i++)
+    for (unsigned i = 0; i < ft->ft_size; i++)
     {
         if (ft->file_handles[i] != NULL)
         {
@@ -87,6 +205,12 @@ void filetable_destroy(struct filetable *ft)
     }
     lock_release(ft->ft_lock);
 
+    if (ft->file_handles != ft->ft_small)
+    {
+        kfree(ft->file_handles);
+    }
+    bitmap_destroy(ft->ft_used);
+    spinlock_cleanup(&ft->ft_reflock);
     lock_destroy(ft->ft_lock);
     kfree(ft);
 }
@@ -95,29 +219,39 @@ void filetable_destroy(struct filetable *ft)
  * @brief Add an entry to the process's file descriptor table that 
  * maps a new file descriptor to this file handle.
  *
+ * The lowest free descriptor is found in the ft_used bitmap with
+ * bitmap_findzero. If every slot is in use, the table grows.
+ *
  * @param ft The file descriptor table to add the file handle to.
  * @param fh The file handle to add.
  *
  * @return The assigned file descriptor for the file handle, 
- * or -1 if the file descriptor table is full.
+ * or -1 if the file descriptor table is full (or can't grow).
  */
 int filetable_add(struct filetable *ft, struct filehandle *fh)
 {
-    int fd = -1;
+    unsigned fd, size;
+
+    KASSERT(ft->ft_refcount == 1);
     lock_acquire(ft->ft_lock);
 
-    // Find the first available file descriptor
-    for (int i = 0; i < OPEN_MAX; i++)
+    // Find the first available file descriptor, growing the table if there is none
+    size = ft->ft_size;
+    if (bitmap_findzero(ft->ft_used, 0, &fd) != 0)
     {
-        if (ft->file_handles[i] == NULL)
+        if (size >= OPEN_MAX || ft_grow(ft, size + 1) != 0)
         {
-            ft->file_handles[i] = fh;
-            filehandle_incref(fh);
-            fd = i;
-            break;
+            lock_release(ft->ft_lock);
+            return -1;
         }
+        fd = size;
     }
 
+    KASSERT(ft->file_handles[fd] == NULL);
+    ft->file_handles[fd] = fh;
+    bitmap_mark(ft->ft_used, fd);
+    filehandle_incref(fh);
+
     lock_release(ft->ft_lock);
     return fd;
 }
@@ -136,26 +270,113 @@ int filetable_add(struct filetable *ft, struct filehandle *fh)
  */
 int filetable_remove(struct filetable *ft, int fd)
 {
+    struct filehandle *fh;
+
     if (fd < 0 || fd >= OPEN_MAX)
     {
         return EBADF;
     }
 
+    KASSERT(ft->ft_refcount == 1);
     lock_acquire(ft->ft_lock);
-    if (ft->file_handles[fd] != NULL)
+    if ((unsigned)fd >= ft->ft_size || ft->file_handles[fd] == NULL)
+    {
+        lock_release(ft->ft_lock);
+        return EBADF;
+    }
+    fh = ft->file_handles[fd];
+    ft->file_handles[fd] = NULL;
+    bitmap_unmark(ft->ft_used, fd);
+    lock_release(ft->ft_lock);
+
+    filehandle_decref(fh);
+    return 0;
+}
+
+/**
+ * @brief Make newfd refer to the same file handle as oldfd, closing
+ * whatever newfd referred to before.
+ *
+ * The table grows if newfd is past the end of it.
+ *
+ * @param ft The file descriptor table.
+ * @param oldfd The open file descriptor to duplicate.
+ * @param newfd The descriptor to make refer to it; may be open or not.
+ * @return 0 on success, EBADF if oldfd is not open or either
+ *         descriptor is out of range, or ENOMEM.
+ */
+int filetable_dup(struct filetable *ft, int oldfd, int newfd)
+{
+    struct filehandle *old_fh, *new_fh;
+    int result;
+
+    if (oldfd < 0 || oldfd >= OPEN_MAX || newfd < 0 || newfd >= OPEN_MAX)
     {
-        filehandle_decref(ft->file_handles[fd]);
-        ft->file_handles[fd] = NULL;
+        return EBADF;
     }
-    else {
+
+    KASSERT(ft->ft_refcount == 1);
+    lock_acquire(ft->ft_lock);
+
+    // Get the file handle for oldfd
+    old_fh = filetable_get(ft, oldfd);
+    if (old_fh == NULL)
+    {
         lock_release(ft->ft_lock);
         return EBADF;
     }
+
+    result = ft_grow(ft, newfd + 1);
+    if (result)
+    {
+        lock_release(ft->ft_lock);
+        return result;
+    }
+
+    // Put old_fh in newfd, remembering what was there
+    new_fh = ft->file_handles[newfd];
+    filehandle_incref(old_fh);
+    ft->file_handles[newfd] = old_fh;
+    if (new_fh == NULL)
+    {
+        bitmap_mark(ft->ft_used, newfd);
+    }
+
     lock_release(ft->ft_lock);
-    
+
+    // If newfd was already open, close it
+    if (new_fh != NULL)
+    {
+        filehandle_decref(new_fh);
+    }
     return 0;
 }
 
+/**
+ * @brief Look up the file handle for a file descriptor.
+ *
+ * This is the fast path used by read, write, lseek and mmap, and takes
+ * no lock. A file table is only changed by its own process's thread,
+ * which is the caller, so the entry can't change or lose its reference
+ * while the caller is using it. The handle's own state (offset) is
+ * still protected by fh_lock.
+ *
+ * @param ft The file descriptor table of the current process.
+ * @param fd The file descriptor to look up.
+ * @return The file handle, or NULL if fd is not open or out of range.
+ */
+struct filehandle *
+filetable_get(struct filetable *ft, int fd)
+{
+    KASSERT(ft != NULL);
+
+    if (fd < 0 || (unsigned)fd >= ft->ft_size)
+    {
+        return NULL;
+    }
+    return ft->file_handles[fd];
+}
+
 /**
  * Creates a copy of an existing file table.
  *
@@ -163,7 +384,8 @@ int filetable_remove(struct filetable *ft, int fd)
  * memory for a new file table structure, copies all entries from the old
  * file table to the new one, increments the reference count for each file
  * handle in the new table, and creates new synchronization primitives for
- * the new table.
+ * the new table. A table that has not grown is copied without any
+ * further allocation.
  *
  * @param old_ft Pointer to the file table to be copied.
  *
@@ -186,10 +408,19 @@ filetable_copy(struct filetable *old_ft)
     lock_acquire(old_ft->ft_lock);
     lock_acquire(new_ft->ft_lock);
 
-    for (int i = 0; i < OPEN_MAX; i++) {
+    if (ft_grow(new_ft, old_ft->ft_size)) {
+        lock_release(new_ft->ft_lock);
+        lock_release(old_ft->ft_lock);
+        filetable_destroy(new_ft);
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < old_ft->ft_size; i++) {
         if (old_ft->file_handles[i] != NULL) {
             new_ft->file_handles[i] = old_ft->file_handles[i];
-            new_ft->file_handles[i]->refcount++;
+            bitmap_mark(new_ft->ft_used, i);
+            /* other tables may be taking or dropping references too */
+            filehandle_incref(new_ft->file_handles[i]);
         }
     }
 
@@ -199,6 +430,64 @@ filetable_copy(struct filetable *old_ft)
     return new_ft;
 }
 
+/**
+ * @brief Share a file table with a new process.
+ *
+ * Used by fork instead of filetable_copy: the child gets the parent's
+ * table itself, and the copy is only made if and when one of them
+ * changes it (see filetable_unshare). Children that just exec, or only
+ * use the descriptors they inherited, never pay for it.
+ *
+ * @param ft The file table to share.
+ * @return ft, with another reference.
+ */
+struct filetable *
+filetable_share(struct filetable *ft)
+{
+    KASSERT(ft != NULL);
+
+    spinlock_acquire(&ft->ft_reflock);
+    ft->ft_refcount++;
+    spinlock_release(&ft->ft_reflock);
+
+    return ft;
+}
+
+/**
+ * @brief Make sure the caller's file table isn't shared, so it can be changed.
+ *
+ * If *ftp is shared with another process, replace it with a private
+ * copy and drop the reference to the shared one. Only the thread that
+ * owns *ftp may call this. If another process is unsharing at the same
+ * time, we may both copy; that's only wasted work.
+ *
+ * @param ftp Where the caller keeps its file table (e.g. &curproc->p_ft).
+ * @return 0 on success, or ENOMEM.
+ */
+int filetable_unshare(struct filetable **ftp)
+{
+    struct filetable *ft = *ftp;
+    struct filetable *copy;
+    unsigned refcount;
+
+    spinlock_acquire(&ft->ft_reflock);
+    refcount = ft->ft_refcount;
+    spinlock_release(&ft->ft_reflock);
+    if (refcount == 1)
+    {
+        return 0;
+    }
+
+    copy = filetable_copy(ft);
+    if (copy == NULL)
+    {
+        return ENOMEM;
+    }
+    *ftp = copy;
+    filetable_destroy(ft);
+    return 0;
+}
+
 
 //////////////////////////////////////////////////
 //
@@ -217,18 +506,8 @@ create_stdio_handle(const char *device, int flags)
     struct vnode *vn;
     int result = vfs_open(kstrdup(device), flags, 0, &vn);
     KASSERT(result == 0);
-    
-    struct filehandle *fh = kmalloc(sizeof(struct filehandle));
-    KASSERT(fh != NULL);
-    
-    fh->vn = vn;
-    fh->offset = 0;
-    fh->refcount = 0;
-    fh->flags = flags;
-    fh->fh_lock = lock_create("file_handle_lock");
-    KASSERT(fh->fh_lock != NULL);
-    
-    return fh;
+
+    return filehandle_create(vn, flags);
 }
 
 /**
@@ -236,7 +515,7 @@ create_stdio_handle(const char *device, int flags)
  *
  * This function allocates memory for a new file handle and initializes it with the provided vnode
  * and flags. It also initializes the file handle's offset, reference count, and file status flags. 
- * Additionally, it creates a lock for the file handle for synchronization purposes.
+ * The file handle comes from the file handle cache with its lock already created.
  * 
  * @param vn The vnode associated with the file handle.
  * @param flags The file status flags for the file handle.
@@ -245,15 +524,14 @@ create_stdio_handle(const char *device, int flags)
 struct filehandle *
 filehandle_create(struct vnode *vn, int flags)
 {
-    struct filehandle *fh = kmalloc(sizeof(struct filehandle));
+    struct filehandle *fh = kmem_cache_alloc(filehandle_cache);
     KASSERT(fh != NULL);
 
     fh->vn = vn;
     fh->offset = 0;
     fh->refcount = 0;
     fh->flags = flags;
-    fh->fh_lock = lock_create("file_handle_lock");
-    KASSERT(fh->fh_lock != NULL);
+    // fh_lock is kept by the cache
 
     return fh;
 }
@@ -261,28 +539,26 @@ filehandle_create(struct vnode *vn, int flags)
 /**
  * @brief Destroy a file handle.
  *
- * This function closes the vnode associated with the file handle, destroys the lock associated with the file handle, and
- * frees the memory allocated for the file handle.
- * It is called when the reference count of a file handle reaches 0 and the lock for the file handle is locked.
+ * This function closes the vnode associated with the file handle and returns the file handle
+ * (locks included) to the file handle cache.
+ * It is called when the reference count of a file handle reaches 0.
  *
  * @param fh The file handle to be destroyed.
  */
 void filehandle_destroy(struct filehandle *fh)
 {
     KASSERT(fh != NULL);
-    KASSERT(lock_do_i_hold(fh->fh_lock));
+    KASSERT(fh->refcount == 0);
 
     vfs_close(fh->vn);
-    lock_release(fh->fh_lock);
-    lock_destroy(fh->fh_lock);
-    kfree(fh);
+    kmem_cache_free(filehandle_cache, fh);
 }
 
 /**
  * @brief Increment the reference count of a file handle.
  *
  * This function increments the reference count of a file handle, which is used to determine when a file handle can be
- * safely destroyed. The reference count is incremented atomically to ensure the integrity of the file handle.
+ * safely destroyed. The count has its own spinlock, so this doesn't wait for I/O in progress under fh_lock.
  *
  * @param fh The file handle whose reference count to increment.
  */
@@ -290,9 +566,9 @@ void filehandle_incref(struct filehandle *fh)
 {
     KASSERT(fh != NULL);
 
-    lock_acquire(fh->fh_lock);
+    spinlock_acquire(&fh->fh_reflock);
     fh->refcount++;
-    lock_release(fh->fh_lock);
+    spinlock_release(&fh->fh_reflock);
 }
 
 /**
@@ -300,21 +576,24 @@ void filehandle_incref(struct filehandle *fh)
  *
  * This function decreases the reference count of the provided file handle.
  * If the reference count reaches zero, the file handle is destroyed, 
- * releasing any resources associated with it. The function is protected
- * by a lock to ensure thread safety during the operation.
+ * releasing any resources associated with it. The count is protected
+ * by fh_reflock; nobody else can be using the handle once it reaches zero.
  * 
  * @param fh The file handle whose reference count is to be decremented.
  */
 void filehandle_decref(struct filehandle *fh)
 {
+    unsigned int refcount;
+
     KASSERT(fh != NULL);
 
-    lock_acquire(fh->fh_lock);
-    fh->refcount--;
-    if (fh->refcount == 0)
+    spinlock_acquire(&fh->fh_reflock);
+    KASSERT(fh->refcount > 0);
+    refcount = --fh->refcount;
+    spinlock_release(&fh->fh_reflock);
+
+    if (refcount == 0)
     {
         filehandle_destroy(fh);
-        return;
     }
-    lock_release(fh->fh_lock);
 }
\ No newline at end of file
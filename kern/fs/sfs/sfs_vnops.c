@@ -40,6 +40,7 @@
 #include <uio.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <pagecache.h>
 #include "sfsprivate.h"
 
 ////////////////////////////////////////////////////////////
@@ -91,38 +92,48 @@ sfs_eachopendir(struct vnode *v, int openflags)
 }
 
 /*
- * Called for read(). sfs_io() does the work.
+ * sfs_io() in the shape pagecache_rw() wants.
+ */
+static
+int
+sfs_pcio(struct vnode *v, struct uio *uio)
+{
+	return sfs_io(v->vn_data, uio);
+}
+
+/*
+ * Called for read(). sfs_io() does the work, by way of the page cache
+ * so we see what has been written through mappings.
  */
 static
 int
 sfs_read(struct vnode *v, struct uio *uio)
 {
-	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
 	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
+	result = pagecache_rw(v, uio, sfs_pcio);
 	vfs_biglock_release();
 
 	return result;
 }
 
 /*
- * Called for write(). sfs_io() does the work.
+ * Called for write(). sfs_io() does the work, by way of the page cache
+ * so mappings see what we write.
  */
 static
 int
 sfs_write(struct vnode *v, struct uio *uio)
 {
-	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
 	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
+	result = pagecache_rw(v, uio, sfs_pcio);
 	vfs_biglock_release();
 
 	return result;
@@ -231,14 +242,15 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Any regular file can be mapped; the VM system
+ * reads and writes its pages with VOP_READ and VOP_WRITE.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 /*
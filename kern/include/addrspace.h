@@ -39,13 +39,39 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
+struct pagetable;
+
+
+/*
+ * A region is a range of pages the process is allowed to touch, with
+ * the permissions given when it was defined. Pages inside a region
+ * are created zero-filled on first use, unless the region maps a file
+ * (rg_vnode), in which case they come from the page cache.
+ */
+
+/* Region permission bits */
+#define RG_READ     0x4
+#define RG_WRITE    0x2
+#define RG_EXEC     0x1
+
+struct region {
+        vaddr_t rg_base;                /* First address (page aligned) */
+        size_t rg_npages;               /* Length in pages */
+        int rg_perms;                   /* RG_* */
+        int rg_mapflags;                /* MAP_* if made by mmap, else 0 */
+        struct vnode *rg_vnode;         /* Mapped file, or NULL */
+        off_t rg_offset;                /* File offset of rg_base */
+        struct region *rg_next;         /* Next region in the list */
+};
+
+/* Size of the user stack region (it costs nothing until touched) */
+#define VM_STACKPAGES    1024
 
 
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
- *
- * You write this.
  */
 
 struct addrspace {
@@ -58,7 +84,12 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct region *as_regions;      /* List of defined regions */
+        struct pagetable *as_pt;        /* Two-level page table */
+        struct lock *as_lock;           /* Serializes faults and changes */
+        bool as_loading;                /* Ignore RG_WRITE while loading */
+        struct region *as_heap;         /* Heap region, or NULL if none yet */
+        vaddr_t as_heapend;             /* Current break */
 #endif
 };
 
@@ -99,6 +130,20 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_findregion - return the region containing VADDR, or NULL.
+ *
+ *    as_sbrk   - move the end of the heap by AMOUNT bytes (which may
+ *                be negative), handing back the old end in OLDBREAK.
+ *                Pages no longer in the heap are freed.
+ *
+ *    as_mmap   - add a region of LEN bytes mapping VN (NULL for
+ *                anonymous memory) from OFFSET, with RG_* permissions
+ *                PERMS and MAP_* flags MAPFLAGS, at an address of the
+ *                kernel's choosing, handed back in RET.
+ *
+ *    as_munmap - remove the mmap regions in [ADDR, ADDR+LEN). Each
+ *                must lie entirely inside the range.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -117,6 +162,15 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, size_t len, int perms,
+                          struct vnode *vn, off_t offset, int mapflags,
+                          vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+#if !OPT_DUMBVM
+struct region    *as_findregion(struct addrspace *as, vaddr_t vaddr);
+#endif
 
 
 /*
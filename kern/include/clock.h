@@ -57,10 +57,33 @@ void hardclock_bootstrap(void);
 void hardclock(void);
 
 /*
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timerclock() is called on one CPU by the timer device each time it
+ * goes off. It runs timeouts that are due and once a second wakes up
+ * everything in clocksleep. The device driver hands itself over with
+ * timerclock_attach(), passing a function that makes it go off once,
+ * USECS microseconds later.
  */
 void timerclock(void);
+void timerclock_attach(void (*arm)(void *dev, uint32_t usecs), void *dev);
+
+/*
+ * Timeouts: call TO_FUNC(TO_DATA) from the timer interrupt at time of
+ * day TO_WHEN, to within the timer device's resolution. TO_FUNC must
+ * not sleep. The caller owns the structure, which must stay put until
+ * the function has been called; there is no way to cancel a timeout.
+ */
+struct timeout {
+	struct timespec to_when;	/* When to call */
+	void (*to_func)(void *);	/* What to call */
+	void *to_data;			/* Argument for to_func */
+
+	/* Private to clock.c */
+	struct timeout *to_left;	/* Leftist heap links */
+	struct timeout *to_right;
+	unsigned to_rank;		/* Length of right spine */
+};
+
+void timeout_add(struct timeout *to);
 
 /*
  * gettime() may be used to fetch the current time of day.
@@ -72,6 +95,7 @@ void gettime(struct timespec *ret);
  *
  * add: ret = t1 + t2
  * sub: ret = t1 - t2
+ * cmp: returns <0, 0, or >0 as t1 is before, equal to, or after t2
  */
 
 void timespec_add(const struct timespec *t1,
@@ -80,6 +104,8 @@ void timespec_add(const struct timespec *t1,
 void timespec_sub(const struct timespec *t1,
 		  const struct timespec *t2,
 		  struct timespec *ret);
+int timespec_cmp(const struct timespec *t1,
+		 const struct timespec *t2);
 
 /*
  * clocksleep() suspends execution for the requested number of seconds,
@@ -87,5 +113,11 @@ void timespec_sub(const struct timespec *t1,
  */
 void clocksleep(int seconds);
 
+/*
+ * clocksleep_until() suspends execution until the time of day reaches
+ * WHEN. Returns an error code if it could not sleep.
+ */
+int clocksleep_until(const struct timespec *when);
+
 
 #endif /* _CLOCK_H_ */
@@ -0,0 +1,108 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical page (frame) allocator.
+ *
+ * The coremap has one entry for every physical page of RAM. It is
+ * built by coremap_bootstrap() from ram_getsize() and
+ * ram_getfirstfree(); before that, allocations are satisfied with
+ * ram_stealmem() and can never be returned.
+ *
+ * When memory runs out, single-page allocations evict a user page to
+ * swap, chosen by a clock (second-chance) sweep over the coremap.
+ */
+
+#include <spinlock.h>
+#include <vm.h>
+
+struct addrspace;
+
+/* Frame states */
+#define CME_FREE     0   /* Available for allocation */
+#define CME_FIXED    1   /* Kernel image, coremap, or stolen at boot */
+#define CME_KERNEL   2   /* Allocated to the kernel (alloc_kpages) */
+#define CME_USER     3   /* Allocated to a user address space */
+
+/* Coremap entry: one per physical page */
+struct coremap_entry {
+	struct addrspace *cme_owner;	/* Owning address space, NULL for kernel */
+	vaddr_t cme_vaddr;		/* Where the owner maps it (user pages) */
+	unsigned cme_npages;		/* Length of the run (first page only) */
+	unsigned cme_refcount;		/* Mappings of the run (first page only) */
+	uint8_t cme_state;		/* CME_* */
+	bool cme_busy;			/* Being filled or evicted; hands off */
+	bool cme_referenced;		/* Used since the clock hand went by */
+};
+
+/*
+ * Protects the coremap, and also the contents of every user page
+ * table entry, so that the evictor can take a page away from an
+ * address space without holding that address space's lock.
+ */
+extern struct spinlock coremap_lock;
+
+/*
+ * Take over management of physical memory from ram.c.
+ * Called from vm_bootstrap().
+ */
+void coremap_bootstrap(void);
+
+/*
+ * Allocate NPAGES physically contiguous pages on behalf of OWNER
+ * (NULL for the kernel). Returns the physical address of the first
+ * page, or 0 if no run of that length is free.
+ */
+paddr_t coremap_getppages(unsigned long npages, struct addrspace *owner);
+
+/*
+ * Drop a reference to a run previously returned by coremap_getppages.
+ * PADDR must be the address of the first page of the run. The run is
+ * freed when the last reference goes away.
+ */
+void coremap_freeppages(paddr_t paddr);
+
+/* Number of bytes of physical memory currently allocated. */
+unsigned coremap_used_bytes(void);
+
+/*
+ * User pages.
+ *
+ *    coremap_getupage  - allocate a page to be mapped at VADDR in AS.
+ *                        The page comes back busy, so it cannot be
+ *                        evicted before it is entered in the page
+ *                        table; call coremap_unbusy after that.
+ *                        Returns 0 if memory and swap are exhausted.
+ *                        AS is NULL for page cache pages, which have
+ *                        no owner and so are never evicted.
+ *
+ * The rest must be called with coremap_lock held:
+ *
+ *    coremap_freeupage - drop AS's reference (or the page cache's, if
+ *                        AS is NULL) to a user page. (This
+ *                        has to happen atomically with clearing the
+ *                        page table entry, or the evictor could find
+ *                        the page and not the entry.)
+ *
+ *    coremap_unbusy    - let a page from coremap_getupage be evicted.
+ *
+ *    coremap_share     - take another reference to a user page that
+ *                        is being shared copy-on-write.
+ *
+ *    coremap_refcount  - number of references to a user page.
+ *
+ *    coremap_touch     - note that AS has just loaded a mapping for
+ *                        a user page, for the clock's benefit.
+ *
+ *    coremap_wait      - sleep until some page table entry marked
+ *                        PTE_BUSY stops being busy.
+ */
+paddr_t  coremap_getupage(struct addrspace *as, vaddr_t vaddr);
+void     coremap_freeupage(paddr_t paddr, struct addrspace *as);
+void     coremap_unbusy(paddr_t paddr);
+void     coremap_share(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+void     coremap_touch(paddr_t paddr, struct addrspace *as);
+void     coremap_wait(void);
+
+#endif /* _COREMAP_H_ */
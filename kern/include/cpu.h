@@ -35,6 +35,13 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+struct kmalloc_cpu;	/* Private to kmalloc.c */
+
+/*
+ * Number of scheduler priority levels, and so of run queues on each
+ * cpu. Level 0 is the highest. See schedule() in thread.c.
+ */
+#define SCHED_NPRIO	4
 
 /*
  * Per-cpu structure
@@ -61,14 +68,17 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct kmalloc_cpu *c_kmalloc;	/* kmalloc's per-cpu caches */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NPRIO]; /* Run queues, by priority */
+	unsigned c_runcount;		/* Threads on all run queues */
 	struct spinlock c_runqueue_lock;
+	struct spinlock_stats c_runqueue_stats;
 
 	/*
 	 * Accessed by other cpus.
@@ -83,10 +93,15 @@ struct cpu {
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
+	 *
+	 * c_shootdown_gen is bumped each time this cpu finishes
+	 * processing its shootdown queue, so a sender can wait for its
+	 * request to be done by watching it change.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	volatile unsigned c_shootdown_gen;
 	struct spinlock c_ipi_lock;
 };
 
@@ -98,7 +113,8 @@ struct cpu {
  * cpu_create creates a cpu; it is suitable for calling from driver-
  * or bus-specific code that looks for secondary CPUs.
  *
- * cpu_create calls cpu_machdep_init.
+ * cpu_create calls cpu_machdep_init, and kmalloc_cpuinit to set up
+ * the cpu's kmalloc caches.
  *
  * cpu_start_secondary is the platform-dependent assembly language
  * entry point for new CPUs; it can be found in start.S. It calls
@@ -107,6 +123,7 @@ struct cpu {
  */
 struct cpu *cpu_create(unsigned hardware_number);
 void cpu_machdep_init(struct cpu *);
+void kmalloc_cpuinit(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
@@ -140,6 +157,13 @@ void cpu_irqon(void);
 void cpu_idle(void);
 void cpu_halt(void);
 
+/*
+ * Read the current CPU's cycle counter. The counter may be reset now
+ * and then (on System/161, each time the on-chip timer goes off), so it
+ * is only good for timing short intervals.
+ */
+uint32_t cpu_cycles(void);
+
 /*
  * Interprocessor interrupts.
  *
@@ -153,6 +177,11 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_wait applies NUM pieces of TLB shootdown data on
+ * every CPU, including the current one, and does not return until all
+ * of them have acted on it. Each CPU gets one IPI for the whole batch;
+ * if NUM exceeds TLBSHOOTDOWN_MAX, the whole TLB is flushed instead.
+ * It must be called without any spinlocks held.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -167,6 +196,7 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_wait(const struct tlbshootdown *mappings, unsigned num);
 
 void interprocessor_interrupt(void);
 
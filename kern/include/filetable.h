@@ -2,9 +2,11 @@
 #define _FILETABLE_H_
 
 #include <types.h>
+#include <spinlock.h>
 #include <synch.h>
 #include <vnode.h>
 #include <limits.h>
+#include <bitmap.h>
 
 /* File handle structure */
 struct filehandle {
@@ -12,22 +14,51 @@ struct filehandle {
     off_t offset;           // Current file offset
     unsigned int refcount;  // Reference count
     int flags;              // file status flags
-    struct lock *fh_lock;   // Lock for the file handle
+    struct lock *fh_lock;   // Lock for the file handle; held across I/O
+    struct spinlock fh_reflock; // Lock for refcount only
 };
 
-/* Per-process file descriptor table */
+/* Descriptor slots built into each table */
+#define FT_NSMALL       32
+
+/*
+ * Per-process file descriptor table. Only the process's own thread
+ * changes it, so looking up a descriptor (filetable_get) takes no lock.
+ *
+ * The table starts out using the FT_NSMALL slots inside the structure,
+ * which is all most processes need, and doubles (up to OPEN_MAX) when
+ * it fills up. ft_used has a bit per slot, set if the slot is in use,
+ * so finding the lowest free descriptor is a bitmap_findzero.
+ *
+ * After fork, parent and child share one table (ft_refcount > 1) until
+ * one of them changes it. A shared table is never changed: open, close
+ * and dup2 call filetable_unshare first, which gives the caller a copy
+ * of its own if the table is shared.
+ */
 struct filetable {
-    struct filehandle *file_handles[OPEN_MAX];
-    struct lock *ft_lock;  // Lock for the file descriptor table
+    struct filehandle **file_handles;  // ft_size slots; ft_small until the table grows
+    struct bitmap *ft_used;            // bit per slot, set if in use
+    unsigned ft_size;                  // Number of slots
+    struct lock *ft_lock;      // Lock for changes to the table and for copying it
+    unsigned ft_refcount;      // Number of processes using the table
+    struct spinlock ft_reflock; // Lock for ft_refcount
+    struct filehandle *ft_small[FT_NSMALL];
 };
 
+/* Set up the file handle cache; called once during system startup */
+void filetable_bootstrap(void);
+
 /* File descriptor table functions */
 struct filetable *filetable_create(void);
 void filetable_stdio_init(struct filetable *ft);
 void filetable_destroy(struct filetable *ft);
 int filetable_add(struct filetable *ft, struct filehandle *fh);
 int filetable_remove(struct filetable *ft, int fd);
+int filetable_dup(struct filetable *ft, int oldfd, int newfd);
+struct filehandle *filetable_get(struct filetable *ft, int fd);
 struct filetable *filetable_copy(struct filetable *old_ft);
+struct filetable *filetable_share(struct filetable *ft);
+int filetable_unshare(struct filetable **ftp);
 
 /* File handle functions */
 struct filehandle *create_stdio_handle(const char *device, int flags);
@@ -0,0 +1,19 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Definitions for mmap().
+ */
+
+/* Protection (the PROT argument). Only PROT_WRITE is enforced. */
+#define PROT_NONE     0
+#define PROT_READ     1
+#define PROT_WRITE    2
+#define PROT_EXEC     4
+
+/* Flags (the FLAGS argument). Exactly one of the first two is required. */
+#define MAP_SHARED    0x0001	/* Writes go to the file */
+#define MAP_PRIVATE   0x0002	/* Writes are private to this process */
+#define MAP_ANON      0x1000	/* No file; zero-filled memory (MAP_PRIVATE only) */
+
+#endif /* _KERN_MMAN_H_ */
@@ -0,0 +1,50 @@
+#ifndef _KMEM_H_
+#define _KMEM_H_
+
+/*
+ * Object caches for fixed-size kernel objects.
+ *
+ * A cache hands out objects of one size, carved out of whole pages
+ * ("slabs") so there is no rounding up to a kmalloc size class. If the
+ * cache has a constructor, every object is constructed once, when its
+ * slab is made, and freed objects are expected to be handed back in
+ * constructed state: whatever the constructor set up (locks, wait
+ * channels, buffers) is still there the next time the object is
+ * allocated. The destructor runs only when the slab is given back.
+ *
+ * Objects must be small enough that at least one fits on a page along
+ * with the slab header; caches are meant for things much smaller than
+ * that.
+ */
+
+struct kmem_cache;	/* Opaque */
+
+/*
+ * Functions:
+ *
+ *    kmem_cache_create  - make a cache of SIZE-byte objects. CTOR, if
+ *                         not NULL, constructs an object and returns 0
+ *                         or an error code; DTOR, if not NULL, undoes
+ *                         it. NAME should be a string constant.
+ *                         Returns NULL if out of memory.
+ *
+ *    kmem_cache_alloc   - get an object. Returns NULL if out of memory
+ *                         or if the constructor failed.
+ *
+ *    kmem_cache_free    - give back an object from kmem_cache_alloc,
+ *                         in constructed state.
+ *
+ *    kmem_cache_destroy - destroy a cache. Every object must have been
+ *                         freed.
+ *
+ * The constructor and destructor may sleep. kmem_cache_alloc may sleep
+ * when it has to construct a new slab.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+void kmem_cache_destroy(struct kmem_cache *kc);
+
+#endif /* _KMEM_H_ */
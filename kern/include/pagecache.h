@@ -0,0 +1,70 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Page cache for mapped files.
+ *
+ * Every page of a file that is mapped anywhere has exactly one
+ * physical copy, found by (vnode, offset). Address spaces that map the
+ * page point their page table entries at that frame, so a file mapped
+ * by several processes is read from disk once. MAP_PRIVATE mappings
+ * map it copy-on-write; MAP_SHARED ones write it in place.
+ *
+ * A cached page counts the page table entries (in mapped-file regions)
+ * that have ever been filled from it and not yet unmapped. When the
+ * last one is unmapped, the page is written back if any shared
+ * mapping wrote to it, and dropped.
+ *
+ * File systems send read and write through pagecache_rw, so read()
+ * and write() see the same data as mappings of the file do while the
+ * pages are cached: reads of cached pages come from the cache, and
+ * writes to the file are copied into any cached pages they cover.
+ * A file with no cached pages (vn_cachedpages is 0) goes straight to
+ * the file system.
+ */
+
+#include <vm.h>
+#include "opt-dumbvm.h"
+
+struct vnode;
+struct uio;
+
+/*
+ * Functions in pagecache.c:
+ *
+ *    pagecache_bootstrap - initialize. Called from vm_bootstrap.
+ *
+ *    pagecache_get - find or read in the page at OFFSET (page-aligned)
+ *                    in VN and count a new mapping of it. Hands back
+ *                    its physical address with a coremap reference
+ *                    for the mapping. Returns an error code.
+ *
+ *    pagecache_ref - count another mapping of a page that is already
+ *                    mapped (as when fork copies a page table).
+ *
+ *    pagecache_put - uncount a mapping. DIRTY means the mapping was
+ *                    shared and was written to. The caller must already
+ *                    have dropped the mapping's coremap reference, if
+ *                    it still had one.
+ *
+ *    pagecache_rw  - do the read or write UIO on VN, coherently with
+ *                    VN's cached pages. DOIO does the file system's
+ *                    own I/O on the file. For file systems' read and
+ *                    write operations; the caller must hold
+ *                    vfs_biglock. Returns an error code.
+ *
+ * These may sleep.
+ */
+void pagecache_bootstrap(void);
+int  pagecache_get(struct vnode *vn, off_t offset, paddr_t *ret);
+void pagecache_ref(struct vnode *vn, off_t offset);
+void pagecache_put(struct vnode *vn, off_t offset, bool dirty);
+#if OPT_DUMBVM
+/* dumbvm has no mmap, so there is nothing to be coherent with. */
+#define pagecache_rw(vn, uio, doio) ((doio)(vn, uio))
+#else
+int  pagecache_rw(struct vnode *vn, struct uio *uio,
+                  int (*doio)(struct vnode *vn, struct uio *uio));
+#endif
+
+#endif /* _PAGECACHE_H_ */
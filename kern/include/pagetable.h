@@ -0,0 +1,93 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page table.
+ *
+ * A user virtual address is split 10/10/12: the top ten bits index
+ * the directory, the next ten index a second-level table, and the
+ * low twelve are the offset within the page. Both levels are exactly
+ * one page long. Second-level tables are allocated the first time a
+ * page in the 4M range they cover is touched, so sparse address
+ * spaces only pay for the parts they use.
+ */
+
+#include <vm.h>
+
+struct addrspace;
+
+typedef uint32_t pte_t;
+
+/*
+ * Fields in a page table entry. An entry is zero (never touched),
+ * PTE_PRESENT with a frame address, or PTE_SWAPPED with a swap slot
+ * number in place of the frame address. PTE_BUSY means the page is on
+ * its way out to swap; wait (coremap_wait) until it clears.
+ *
+ * PTE_SHARED pages are mapped read-only until the first write fault
+ * sets PTE_DIRTY, so that only pages that really were written through
+ * the mapping are written back to the file.
+ *
+ * Entries are read and changed only with coremap_lock held, except
+ * that a zero entry may be looked at without it, since only the
+ * owning address space (holding its own lock) can make it nonzero.
+ */
+#define PTE_FRAME     0xfffff000  /* Physical address of the page */
+#define PTE_PRESENT   0x00000001  /* Page is resident at PTE_FRAME */
+#define PTE_COW       0x00000002  /* Frame is shared; copy before writing */
+#define PTE_SWAPPED   0x00000004  /* Page is in swap slot PTE_SLOT */
+#define PTE_BUSY      0x00000008  /* Being evicted */
+#define PTE_SHARED    0x00000010  /* MAP_SHARED file page; never COW */
+#define PTE_DIRTY     0x00000020  /* PTE_SHARED page written through here */
+
+#define PTE_SLOT(pte)          ((pte) >> 12)
+#define PTE_MKSWAPPED(slot)    (((pte_t)(slot) << 12) | PTE_SWAPPED)
+
+#define PT_ENTRIES    (PAGE_SIZE / sizeof(pte_t))
+#define PT_L1_INDEX(va)  ((va) >> 22)
+#define PT_L2_INDEX(va)  (((va) >> 12) & (PT_ENTRIES - 1))
+#define PT_VADDR(l1, l2) (((vaddr_t)(l1) << 22) | ((vaddr_t)(l2) << 12))
+
+struct pagetable {
+	pte_t *pt_dir[PT_ENTRIES];	/* Second-level tables, or NULL */
+};
+
+/*
+ * Functions in pagetable.c:
+ *
+ *    pt_create  - allocate an empty page table. Returns NULL on
+ *                 out-of-memory.
+ *
+ *    pt_destroy - release every page and swap slot, every
+ *                 second-level table, and the page table itself. AS
+ *                 is the address space the table belongs to.
+ *
+ *    pt_lookup  - return a pointer to the entry for VADDR. If there
+ *                 is no second-level table for it yet and CREATE is
+ *                 true, one is allocated; otherwise NULL is returned.
+ *                 (With CREATE true, NULL means out of memory.)
+ *
+ *    pt_unmap   - release the pages and swap slots of AS between
+ *                 START and END, which must be page-aligned. The
+ *                 caller must already have flushed them from the TLB.
+ *
+ *    pt_copy    - share every resident page of OLD with NEW (which
+ *                 must be empty, and belongs to NEWAS), marking both
+ *                 copies PTE_COW unless they are PTE_SHARED (NEW's
+ *                 copy starts out clean). Pages of OLD that are
+ *                 swapped out are read back in as private copies for
+ *                 NEW. The caller must flush any writable TLB entries
+ *                 for OLD. Returns an error code.
+ *
+ * The caller is responsible for serializing these against one
+ * another (the address space lock does this).
+ */
+struct pagetable *pt_create(void);
+void              pt_destroy(struct pagetable *pt, struct addrspace *as);
+pte_t            *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+void              pt_unmap(struct pagetable *pt, struct addrspace *as,
+                           vaddr_t start, vaddr_t end);
+int               pt_copy(struct pagetable *old, struct pagetable *new,
+                          struct addrspace *newas);
+
+#endif /* _PAGETABLE_H_ */
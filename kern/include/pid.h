@@ -3,6 +3,11 @@
 
 /*
  * Process ID management.
+ *
+ * Free PIDs are found with a two-level bitmap: one bit per PID, and
+ * one bit per group of PID_GROUP PIDs that is set when the whole group
+ * is in use. Allocating scans the (short) group bitmap and then one
+ * group, and freeing is constant time. Lookups take no lock.
  */
 
 #define PID_KERNEL    1
@@ -13,17 +18,8 @@
 /* Error value returned by pid_allocate */
 #define ENOPID      (-1)    /* No PIDs available */
 
-/* PID table entry structure */
-struct pid_entry {
-    pid_t pid;               /* Process ID */
-    struct proc *proc;      /* Pointer to process structure */
-};
-
-/* Global PID management state */
-struct pid_entry *pid_table;     /* PID allocation table */
-struct spinlock pid_lock;        /* Lock for PID operations */
-unsigned int pid_count;          /* Number of PIDs in use */
-pid_t next_pid;                  /* Next PID to try for allocation */
+/* Number of PIDs summarized by each bit of the group bitmap */
+#define PID_GROUP   32
 
 /* 
  * Initialize the PID management system.
@@ -45,6 +41,7 @@ int pid_to_index(pid_t pid);
 /*
  * Get process structure associated with PID.
  * Returns NULL if PID is invalid or not in use.
+ * Takes no lock; the caller must know the process can't go away.
  */
 struct proc *pid_get_proc(pid_t pid);
 
@@ -45,29 +45,49 @@
 /* Get the machine-dependent bits. */
 #include <machine/spinlock.h>
 
+struct spinlock_stats;	/* below */
+
 /*
  * Basic spinlock.
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * A spinlock is either a test-and-set lock (the default) or a ticket
+ * lock. Waiters for a ticket lock take a number and get the lock in
+ * that order, so it is fair, and while they wait they only read the
+ * lock word, so a release does not set off a storm of test-and-sets.
+ * Taking a ticket costs an atomic operation even when there is no
+ * contention, so use ticket locks for the locks that see contention.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
-	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+	volatile spinlock_data_t splk_lock; /* Memory word where we spin;
+					       for ticket locks, the ticket
+					       now being served. */
+	volatile spinlock_data_t splk_next; /* Next ticket to hand out. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+	bool splk_ticket;		    /* True for a ticket lock. */
+	struct spinlock_stats *splk_stats;  /* Statistics, or NULL. */
 };
 
 /*
- * Initializer for cases where a spinlock needs to be static or global.
+ * Initializers for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL, \
+	  false, NULL }
+#define SPINLOCK_TICKET_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL, \
+	  true, NULL }
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_ticket	Same, for a ticket lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -77,6 +97,7 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_ticket(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
@@ -84,5 +105,35 @@ void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
 
+/*
+ * Contention statistics.
+ *
+ * Any spinlock can be given a struct spinlock_stats to count in with
+ * spinlock_stats_attach. The counters are updated by the holder of
+ * the lock, so they need no locking of their own. Hold times are in
+ * cycles, as measured by cpu_cycles(); samples where the counter was
+ * reset in the middle are dropped. Statistics can't be detached, so
+ * only use them on locks that last forever.
+ *
+ * spinlock_stats_print prints the statistics for every such lock;
+ * spinlock_stats_reset clears them.
+ */
+#define SPINLOCK_STATS_NAMELEN 24
+
+struct spinlock_stats {
+	char ss_name[SPINLOCK_STATS_NAMELEN];
+	uint64_t ss_acquires;		/* Times acquired */
+	uint64_t ss_contended;		/* Times acquired after waiting */
+	uint64_t ss_spins;		/* Trips around the wait loop */
+	uint32_t ss_maxhold;		/* Longest hold, in cycles */
+	uint32_t ss_holdstart;		/* When last acquired */
+	struct spinlock_stats *ss_next;	/* List of all stats */
+};
+
+void spinlock_stats_attach(struct spinlock *lk, struct spinlock_stats *ss,
+			   const char *name);
+void spinlock_stats_print(void);
+void spinlock_stats_reset(void);
+
 
 #endif /* _SPINLOCK_H_ */
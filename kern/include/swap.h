@@ -0,0 +1,41 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * Pages evicted from memory are written to a raw disk device, one
+ * page per slot. Slot allocation is tracked with a bitmap. If the swap
+ * device cannot be opened at boot, the system runs without swap and
+ * swap_alloc always fails.
+ */
+
+#include <vm.h>
+
+/* Device used for swap */
+#define SWAP_DEVICE    "lhd0raw:"
+
+/*
+ * Functions in swap.c:
+ *
+ *    swap_bootstrap - open the swap device. Called from vm_bootstrap.
+ *
+ *    swap_alloc     - allocate a free slot. Returns ENOSPC if there
+ *                     is none.
+ *
+ *    swap_free      - release a slot.
+ *
+ *    swap_in        - read slot SLOT into the physical page PA.
+ *
+ *    swap_out       - write the physical page PA to slot SLOT.
+ *
+ * swap_in and swap_out sleep and must not be called with spinlocks
+ * held.
+ */
+void swap_bootstrap(void);
+int  swap_alloc(unsigned *slot);
+void swap_free(unsigned slot);
+int  swap_in(unsigned slot, paddr_t pa);
+int  swap_out(unsigned slot, paddr_t pa);
+
+#endif /* _SWAP_H_ */
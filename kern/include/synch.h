@@ -35,6 +35,7 @@
  */
 
 #include <spinlock.h>
+#include <cpu.h>	/* for SCHED_NPRIO */
 
 /*
  * Dijkstra-style semaphore.
@@ -75,21 +76,31 @@ struct lock
         char *lk_name;
         // add what you need here
         // (don't forget to mark things volatile as needed)
-        volatile int lk_hold;        /* 0 means the lock is free, while 1 means the lock is held */
+        volatile spinlock_data_t lk_hold; /* 0 means the lock is free; taken by test-and-set */
+        struct thread *volatile lk_holder; /* thread that holds the lock */
+        volatile unsigned lk_waiters; /* threads sleeping, or about to sleep, on the wait channel */
         struct wchan *lk_wchan;      /* wait channel, lists of threads waiting to get the lock */
-        struct spinlock lk_spinlock; /* protect the lock and the wait channel */
-        struct thread *lk_holder;    /* thread that holds the lock */
+        struct spinlock lk_spinlock; /* protect lk_waiters and the wait channel */
+        /* priority inheritance; protected by pi_lock in synch.c */
+        unsigned lk_waitprio[SCHED_NPRIO]; /* sleeping waiters at each priority */
+        struct thread *lk_piowner;   /* thread whose t_pilocks we are on */
+        struct lock *lk_pinext;      /* next on that list */
 };
 
 struct lock *lock_create(const char *name);
 void lock_destroy(struct lock *);
 
+/* Set up the lock cache. Called once during system startup. */
+void synch_bootstrap(void);
+
 /*
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
- *                   same time.
+ *                   same time. Waits by spinning while the holder is
+ *                   running on another cpu, and by sleeping otherwise.
+ *                   A sleeping waiter lends the holder its priority.
  *    lock_release - Free the lock. Only the thread holding the lock may do
- *                   this.
+ *                   this. Gives back any priority lent for it.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
  *
@@ -142,4 +153,48 @@ void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers can hold the lock at once, or one writer.
+ * Writers take precedence: once a writer is waiting, new readers wait
+ * behind it, so a steady stream of readers cannot starve writers.
+ *
+ * Nothing in the kernel uses one at the moment; only the sy5 test
+ * does. The read-mostly structures it was meant for don't need it:
+ * the mount list is only looked at under vfs_biglock, the pid table
+ * is read without locking, and the file table went back to a lock.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock
+{
+        char *rwlock_name;
+        struct wchan *rw_readwchan;  /* readers waiting to get the lock */
+        struct wchan *rw_writewchan; /* writers waiting to get the lock */
+        struct spinlock rw_lock;     /* protect the fields below and the wait channels */
+        unsigned rw_readers;         /* number of readers holding the lock */
+        unsigned rw_writerswaiting;  /* number of writers waiting for the lock */
+        struct thread *rw_writer;    /* writer holding the lock, if any */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Waits while a
+ *                           writer holds the lock or is waiting for it.
+ *    rwlock_release_read  - Free the lock for reading.
+ *    rwlock_acquire_write - Get the lock for writing. Waits until there
+ *                           are no readers or other writer.
+ *    rwlock_release_write - Free the lock for writing. Only the thread
+ *                           holding it for writing may do this.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+
 #endif /* _SYNCH_H_ */
@@ -58,11 +58,17 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t user_req, userptr_t user_rem);
 int sys_open(const_userptr_t filename, int flags, mode_t mode, int32_t *retval);
 int sys_close(int fd);
 int sys_write(int fd, const_userptr_t buf_ptr, size_t nbytes, int32_t *retval);
 int sys_read(int fd, userptr_t buf_ptr, size_t nbytes, int32_t *retval);
 int sys_lseek(int fd, off_t pos, int whence, off_t *retval);
+int sys_pread(int fd, userptr_t buf_ptr, size_t nbytes, off_t offset, int32_t *retval);
+int sys_pwrite(int fd, const_userptr_t buf_ptr, size_t nbytes, off_t offset, int32_t *retval);
+int sys_readv(int fd, const_userptr_t iov_ptr, int iovcnt, int32_t *retval);
+int sys_writev(int fd, const_userptr_t iov_ptr, int iovcnt, int32_t *retval);
+int sys_copy_file_range(int infd, int outfd, size_t len, int32_t *retval);
 int sys_dup2(int oldfd, int newfd, int32_t *retval);
 int sys_chdir(const_userptr_t pathname);
 int sys___getcwd(userptr_t buf, size_t buflen, int32_t *retval);
@@ -71,5 +77,9 @@ int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, int *retval);
 void sys__exit(int exitcode);
 int sys_execv(const_userptr_t program, userptr_t *args);
+int sys_sbrk(intptr_t amount, int32_t *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	     off_t offset, int32_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
 
 #endif /* _SYSCALL_H_ */
@@ -41,6 +41,7 @@
 #include <threadlist.h>
 
 struct cpu;
+struct lock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -84,6 +85,38 @@ struct thread {
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
 
+	/*
+	 * Scheduler fields. t_priority is the run queue level (0 is
+	 * the highest), t_ticks counts hardclocks used at that level,
+	 * and t_readysince and t_lastran are the cpu's c_hardclocks
+	 * when the thread last went on a run queue and last stopped
+	 * running. t_lastran is a cache affinity hint for stealing.
+	 */
+	unsigned t_priority;
+	unsigned t_ticks;
+	unsigned t_readysince;
+	unsigned t_lastran;
+
+	/*
+	 * t_rqcpu and t_rqlevel say which run queue the thread is on,
+	 * if any; they are protected by that cpu's run queue lock.
+	 */
+	struct cpu *t_rqcpu;
+	unsigned t_rqlevel;
+
+	/*
+	 * Priority inheritance (see synch.c). t_inherit is the best
+	 * priority lent to us by threads sleeping on locks we hold, or
+	 * SCHED_NPRIO if none, and t_pilocks lists those locks. While
+	 * we sleep on a lock ourselves, t_waitlock is that lock and
+	 * t_waitprio the priority we are lending. The scheduler runs
+	 * us at the better of t_priority and t_inherit.
+	 */
+	unsigned t_inherit;
+	struct lock *t_pilocks;
+	struct lock *t_waitlock;
+	unsigned t_waitprio;
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -158,7 +191,24 @@ __DEAD void thread_exit(void);
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Charge the current thread for a clock tick, demoting and preempting
+ * it as needed. Called from the timer interrupt.
+ */
+void thread_tick(void);
+
+/*
+ * Priority inheritance support for the lock code.
+ *
+ * thread_getpriority returns the priority T is being scheduled at,
+ * counting anything it has inherited. thread_inherit sets the priority
+ * T inherits (SCHED_NPRIO for none), moving it to another run queue
+ * if it is waiting on one.
+ */
+unsigned thread_getpriority(struct thread *t);
+void thread_inherit(struct thread *t, unsigned prio);
+
+/*
+ * Reshuffle the run queues. Called from the timer interrupt.
  */
 void schedule(void);
 
@@ -59,5 +59,12 @@ void free_kpages(vaddr_t addr);
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/* Invalidate every TLB entry, or the one for VADDR, on the current CPU */
+void vm_tlbflush(void);
+void vm_tlbinvalidate(vaddr_t vaddr);
+
+/* Invalidate NPAGES pages from VADDR on all CPUs, and wait till done */
+void vm_shootdown(vaddr_t vaddr, unsigned npages);
+
 
 #endif /* _VM_H_ */
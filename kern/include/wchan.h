@@ -45,6 +45,12 @@ struct wchan; /* Opaque */
  */
 struct wchan *wchan_create(const char *name);
 
+/*
+ * Change a wait channel's symbolic name. The same rules apply to NAME
+ * as for wchan_create. Nobody may be sleeping on the channel.
+ */
+void wchan_setname(struct wchan *wc, const char *name);
+
 /*
  * Destroy a wait channel. Must be empty and unlocked.
  */
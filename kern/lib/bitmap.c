@@ -95,29 +95,73 @@ bitmap_getdata(struct bitmap *b)
         return b->v;
 }
 
+/*
+ * Return the offset of the lowest cleared bit in W, which must not be
+ * all ones. W+1 carries through the low set bits into the first clear
+ * one, so ~W & (W+1) is that bit alone; then binary search for it.
+ */
+static
+inline
+unsigned
+bitmap_wordzero(WORD_TYPE w)
+{
+        WORD_TYPE mask = (WORD_TYPE)(~w & (w + 1));
+        unsigned offset = 0;
+
+        KASSERT(w != WORD_ALLBITS);
+        KASSERT(BITS_PER_WORD == 8);
+        if ((mask & 0x0f) == 0) {
+                offset += 4;
+                mask >>= 4;
+        }
+        if ((mask & 0x03) == 0) {
+                offset += 2;
+                mask >>= 2;
+        }
+        if ((mask & 0x01) == 0) {
+                offset += 1;
+        }
+        return offset;
+}
+
 int
-bitmap_alloc(struct bitmap *b, unsigned *index)
+bitmap_findzero(struct bitmap *b, unsigned start, unsigned *index)
 {
         unsigned ix;
         unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
+        WORD_TYPE w;
+
+        if (start >= b->nbits) {
+                return ENOSPC;
+        }
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
-                        }
-                        KASSERT(0);
+        /* Treat the bits below START in the first word as set. */
+        ix = start / BITS_PER_WORD;
+        w = b->v[ix] | (WORD_TYPE)((1U << (start % BITS_PER_WORD)) - 1);
+
+        while (w == WORD_ALLBITS) {
+                if (++ix == maxix) {
+                        return ENOSPC;
                 }
+                w = b->v[ix];
+        }
+        *index = ix*BITS_PER_WORD + bitmap_wordzero(w);
+        /* leftover bits past the end are always set */
+        KASSERT(*index < b->nbits);
+        return 0;
+}
+
+int
+bitmap_alloc(struct bitmap *b, unsigned *index)
+{
+        int result;
+
+        result = bitmap_findzero(b, 0, index);
+        if (result) {
+                return result;
         }
-        return ENOSPC;
+        bitmap_mark(b, *index);
+        return 0;
 }
 
 static
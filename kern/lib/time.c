@@ -67,3 +67,19 @@ timespec_sub(const struct timespec *ts1,
 	r.tv_sec -= ts2->tv_sec;
 	*ret = r;
 }
+
+/*
+ * Compare ts1 and ts2
+ */
+int
+timespec_cmp(const struct timespec *ts1,
+	     const struct timespec *ts2)
+{
+	if (ts1->tv_sec != ts2->tv_sec) {
+		return ts1->tv_sec < ts2->tv_sec ? -1 : 1;
+	}
+	if (ts1->tv_nsec != ts2->tv_nsec) {
+		return ts1->tv_nsec < ts2->tv_nsec ? -1 : 1;
+	}
+	return 0;
+}
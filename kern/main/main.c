@@ -108,6 +108,8 @@ boot(void)
 
 	/* Early initialization. */
 	ram_bootstrap();
+	synch_bootstrap();
+	filetable_bootstrap();
 	pid_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
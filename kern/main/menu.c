@@ -35,6 +35,7 @@
 #include <lib.h>
 #include <uio.h>
 #include <clock.h>
+#include <spinlock.h>
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
@@ -418,6 +419,23 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_spinlockstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		spinlock_stats_print();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		spinlock_stats_reset();
+	}
+	else {
+		kprintf("Usage: spl [reset]\n");
+	}
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -491,6 +509,7 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] RW lock test          (1)     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
 	"[fs3] FS write stress               ",
@@ -524,6 +543,7 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[spl] Spinlock stats                ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -578,6 +598,7 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "spl",        cmd_spinlockstats },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -599,6 +620,7 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	rwtest },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
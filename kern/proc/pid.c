@@ -2,10 +2,27 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <membar.h>
+#include <bitmap.h>
 #include <proc.h>
 #include <current.h>
 #include <pid.h>
 
+#define PID_NGROUPS   DIVROUNDUP(PID_COUNT, PID_GROUP)
+
+/*
+ * PID management state. pid_table is indexed by pid_to_index() and
+ * read without locking; everything else, and writes to pid_table, are
+ * protected by pid_lock.
+ */
+static struct proc *volatile *pid_table;   /* Process for each PID */
+static struct bitmap *pid_map;             /* One bit per PID, set if in use */
+static struct bitmap *pid_groups;          /* One bit per group, set if full */
+static unsigned char *pid_groupcount;      /* PIDs in use in each group */
+static struct spinlock pid_lock = SPINLOCK_INITIALIZER;
+static unsigned int pid_count;             /* Number of PIDs in use */
+static pid_t next_pid;                     /* Next PID to try for allocation */
+
 /*
  * Initialize the PID management system
  * Called during system bootstrap
@@ -13,22 +30,23 @@
 void 
 pid_bootstrap(void) 
 {
-    size_t table_size = PID_COUNT * sizeof(struct pid_entry);
-    
     /* Allocate PID table */
-    pid_table = kmalloc(table_size);
-    if (pid_table == NULL) {
+    pid_table = kmalloc(PID_COUNT * sizeof(pid_table[0]));
+    pid_map = bitmap_create(PID_COUNT);
+    pid_groups = bitmap_create(PID_NGROUPS);
+    pid_groupcount = kmalloc(PID_NGROUPS * sizeof(pid_groupcount[0]));
+    if (pid_table == NULL || pid_map == NULL || pid_groups == NULL ||
+        pid_groupcount == NULL) {
         panic("pid_bootstrap: Unable to allocate PID table\n");
     }
 
     /* Initialize PID table entries */
     for (int i = 0; i < PID_COUNT; i++) {
-        pid_table[i].pid = PID_MIN + i;
-        pid_table[i].proc = NULL;
+        pid_table[i] = NULL;
     }
+    bzero(pid_groupcount, PID_NGROUPS * sizeof(pid_groupcount[0]));
 
-    /* Initialize lock and state */
-    spinlock_init(&pid_lock);
+    /* Initialize state */
     pid_count = 0;
     next_pid = PID_MIN;
 }
@@ -43,34 +61,38 @@ int pid_to_index(pid_t pid)
 }
 
 /*
- * Check if a PID entry is available
- * Must be called with pid_lock held
- */
-static inline int
-is_pid_available(struct pid_entry *entry)
-{
-    return entry->proc == NULL;
-}
-
-/*
- * Find next available PID starting from next_pid
- * Must be called with pid_lock held
+ * Find a free PID, starting from next_pid and wrapping around.
+ * Must be called with pid_lock held, and with some PID free.
+ *
+ * First find a group that isn't full, then a free PID in it. In the
+ * group next_pid is in, the free PIDs may all be below next_pid; then
+ * take the lowest one.
  */
 static pid_t 
 find_free_pid(void) 
 {
-    unsigned int start = pid_to_index(next_pid);
-    unsigned int i = start;
+    unsigned start = pid_to_index(next_pid);
+    unsigned group, index;
 
-    /* Search for a free PID */
-    do {
-        if (is_pid_available(&pid_table[i])) {
-            return PID_MIN + i;
+    KASSERT(spinlock_do_i_hold(&pid_lock));
+
+    if (bitmap_findzero(pid_groups, start / PID_GROUP, &group) &&
+        bitmap_findzero(pid_groups, 0, &group)) {
+        return ENOPID;
+    }
+    if (group != start / PID_GROUP) {
+        start = group * PID_GROUP;
+    }
+    if (bitmap_findzero(pid_map, start, &index) ||
+        index / PID_GROUP != group) {
+        if (bitmap_findzero(pid_map, group * PID_GROUP, &index)) {
+            panic("find_free_pid: group %u is not full, but has no "
+                  "free PIDs\n", group);
         }
-        i = (i + 1) % PID_COUNT;
-    } while (i != start);
+    }
+    KASSERT(index / PID_GROUP == group);
 
-    return ENOPID;
+    return PID_MIN + index;
 }
 
 /*
@@ -81,7 +103,7 @@ pid_t
 pid_allocate(struct proc *proc) 
 {
     pid_t pid;
-    int index;
+    unsigned index, group;
 
     KASSERT(proc != NULL);
 
@@ -100,12 +122,23 @@ pid_allocate(struct proc *proc)
         return ENOPID;
     }
 
-    /* Associate PID with process */
+    /* Mark it in use, and its group if that is now full */
     index = pid_to_index(pid);
-    KASSERT(pid_table[index].proc == NULL);
-    pid_table[index].proc = proc;
+    group = index / PID_GROUP;
+    bitmap_mark(pid_map, index);
+    pid_groupcount[group]++;
+    if (pid_groupcount[group] == PID_GROUP ||
+        (group == PID_NGROUPS - 1 &&
+         pid_groupcount[group] == PID_COUNT - group * PID_GROUP)) {
+        bitmap_mark(pid_groups, group);
+    }
     pid_count++;
 
+    /* Associate PID with process; make its contents visible first */
+    KASSERT(pid_table[index] == NULL);
+    membar_store_store();
+    pid_table[index] = proc;
+
     /* Update next_pid to start search from next position */
     next_pid = (pid < PID_MAX) ? (pid + 1) : PID_MIN;
 
@@ -116,23 +149,23 @@ pid_allocate(struct proc *proc)
 /*
  * Get process structure associated with PID
  * Returns NULL if PID is invalid or not in use
+ *
+ * A single aligned pointer load is atomic, so no lock is needed to
+ * read the table. Whether the process stays around afterwards is up
+ * to the caller, as it always was.
  */
 struct proc *
 pid_get_proc(pid_t pid) 
 {
-    struct proc *p = NULL;
+    struct proc *p;
     
     /* Validate PID */
     if (pid < PID_MIN || pid > PID_MAX) {
         return NULL;
     }
 
-    spinlock_acquire(&pid_lock);
-    
-    int index = pid_to_index(pid);
-    p = pid_table[index].proc;
-    
-    spinlock_release(&pid_lock);
+    p = pid_table[pid_to_index(pid)];
+    membar_load_load();
     return p;
 }
 
@@ -140,8 +173,19 @@ pid_get_proc(pid_t pid)
  * Remove process from PID table 
  */
 void proc_remove_pid(struct proc *proc) {
+    unsigned index, group;
+
+    index = pid_to_index(proc->p_pid);
+    group = index / PID_GROUP;
+
     spinlock_acquire(&pid_lock);
-    pid_table[pid_to_index(proc->p_pid)].proc = NULL;
+    KASSERT(pid_table[index] == proc);
+    pid_table[index] = NULL;
+    bitmap_unmark(pid_map, index);
+    if (bitmap_isset(pid_groups, group)) {
+        bitmap_unmark(pid_groups, group);
+    }
+    pid_groupcount[group]--;
     pid_count--;
     spinlock_release(&pid_lock);
-}
\ No newline at end of file
+}
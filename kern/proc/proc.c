@@ -43,11 +43,13 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
+#include <kmem.h>
 #include <pid.h>
 
 /*
@@ -56,7 +58,62 @@
 struct proc *kproc;
 
 /*
- * Create a proc structure.
+ * Proc structures come from an object cache. A free proc keeps its
+ * locks, semaphore, condition variable, and child array, so fork
+ * doesn't have to create them all again.
+ */
+static struct kmem_cache *proc_cache;
+
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_init(&proc->p_threads);
+	spinlock_init(&proc->p_lock);
+	proc->p_mutex = lock_create("proc_mutex");
+	proc->p_children = array_create();
+	proc->p_sem = sem_create("proc_sem", 0);
+	proc->p_cv = cv_create("proc_cv");
+	if (proc->p_mutex == NULL || proc->p_children == NULL ||
+	    proc->p_sem == NULL || proc->p_cv == NULL) {
+		if (proc->p_mutex != NULL) {
+			lock_destroy(proc->p_mutex);
+		}
+		if (proc->p_children != NULL) {
+			array_destroy(proc->p_children);
+		}
+		if (proc->p_sem != NULL) {
+			sem_destroy(proc->p_sem);
+		}
+		if (proc->p_cv != NULL) {
+			cv_destroy(proc->p_cv);
+		}
+		spinlock_cleanup(&proc->p_lock);
+		threadarray_cleanup(&proc->p_threads);
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+	lock_destroy(proc->p_mutex);
+	array_destroy(proc->p_children);
+	sem_destroy(proc->p_sem);
+	cv_destroy(proc->p_cv);
+}
+
+/*
+ * Create a proc structure. It has no file table; the caller sets
+ * one up.
  */
 static
 struct proc *
@@ -64,24 +121,19 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
 
-	threadarray_init(&proc->p_threads);
-	spinlock_init(&proc->p_lock);
-	proc->p_mutex = lock_create("proc_mutex");
-	if (proc->p_mutex == NULL) {
-		kfree(proc->p_name);
-		kfree(proc);
-		return NULL;
-	}
+	/* The locks, semaphore, CV and child array are constructed. */
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
+	KASSERT(array_num(proc->p_children) == 0);
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
@@ -89,14 +141,8 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-	/* Initialize the file table */
-	proc->p_ft = filetable_create();
-	if (proc->p_ft == NULL) {
-		kfree(proc->p_name);
-		kfree(proc);
-		lock_destroy(proc->p_mutex);
-		return NULL;
-	}
+	/* File table; set by caller */
+	proc->p_ft = NULL;
 
 	/* Process PID fields. Will be set by caller */
     proc->p_pid = 0;
@@ -104,15 +150,6 @@ proc_create(const char *name)
 	/* Parent process fields */
     proc->p_parent = NULL;
 
-	/* Child processes fields */
-	proc->p_children = array_create();
-
-	/* Semaphore for waiting */
-	proc->p_sem = sem_create("proc_sem", 0);
-
-	/* CV for waiting */
-	proc->p_cv = cv_create("proc_cv");
-
 	/* Process state fields */
     proc->p_state = PROC_RUNNING;
 
@@ -202,24 +239,21 @@ proc_destroy(struct proc *proc)
 		as_destroy(as);
 	}
 
-	/* Free the file table */
+	/* Drop our reference to the file table */
 	if (proc->p_ft) {
 		filetable_destroy(proc->p_ft);
 	}
 
-	/* Free the children array */
-	if (proc->p_children) {
-		array_destroy(proc->p_children);
-	}
-
-	threadarray_cleanup(&proc->p_threads);
-	spinlock_cleanup(&proc->p_lock);
-	lock_destroy(proc->p_mutex);
-	sem_destroy(proc->p_sem);
-	cv_destroy(proc->p_cv);
+	/*
+	 * Hand the structure back to the cache; the threads and
+	 * children arrays must be empty, as their cleanup would
+	 * insist.
+	 */
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
+	KASSERT(array_num(proc->p_children) == 0);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(proc_cache, proc);
 }
 
 /*
@@ -228,10 +262,20 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc),
+				       proc_ctor, proc_dtor);
+	if (proc_cache == NULL) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
 	}
+	kproc->p_ft = filetable_create();
+	if (kproc->p_ft == NULL) {
+		panic("filetable_create for kproc failed\n");
+	}
 
 	/* Allocate PID for kernel process */
 	kproc->p_pid = PID_KERNEL;
@@ -250,13 +294,8 @@ proc_create_fork(const char *name)
 
     newproc->p_addrspace = NULL;
 	
-	/* Copy file table from parent process. */
-    newproc->p_ft = filetable_copy(curproc->p_ft);
-    if (newproc->p_ft == NULL)
-    {
-        proc_destroy(newproc);
-        return NULL;
-    }
+	/* Share the parent's file table; the first change copies it. */
+    newproc->p_ft = filetable_share(curproc->p_ft);
 
 	/* Allocate PID */
     newproc->p_pid = pid_allocate(newproc);
@@ -305,6 +344,11 @@ proc_create_runprogram(const char *name)
 		return NULL;
 	}
 
+	newproc->p_ft = filetable_create();
+	if (newproc->p_ft == NULL) {
+		proc_destroy(newproc);
+		return NULL;
+	}
 	filetable_stdio_init(newproc->p_ft);
 
 	/* Allocate PID */
@@ -20,11 +20,19 @@ sys_close(int fd)
     }
     
     /* Get the current process's file descriptor table */
-    struct filetable *ft = curproc->p_ft;
-    KASSERT(ft != NULL);
+    KASSERT(curproc->p_ft != NULL);
+    if (filetable_get(curproc->p_ft, fd) == NULL) {
+        return EBADF;
+    }
+
+    /* Get a table of our own, if we're sharing it since fork */
+    int result = filetable_unshare(&curproc->p_ft);
+    if (result) {
+        return result;
+    }
 
     /* Remove the file handle from the file descriptor table */
-    int result = filetable_remove(ft, fd);
+    result = filetable_remove(curproc->p_ft, fd);
     if (result) {
         return result;      // Indicate failure
     }
@@ -0,0 +1,147 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/sfs.h>
+#include <lib.h>
+#include <uio.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <vnode.h>
+#include <filetable.h>
+#include <syscall.h>
+
+/* Size of the kernel bounce buffer; a whole number of SFS blocks. */
+#define COPY_CHUNK (8 * SFS_BLOCKSIZE)
+
+/* Largest total length; the result has to fit in an ssize_t. */
+#define COPY_MAXTOTAL 0x7fffffff
+
+/*
+ * In-kernel file copy: read from INFD and write to OUTFD through a
+ * kernel buffer, so the data never goes through user space. Both file
+ * offsets are used and updated, as if by read and write. After the
+ * first chunk the reads start on SFS block boundaries, so SFS can move
+ * whole blocks instead of reading partial blocks in and out.
+ *
+ * Both handles' fh_locks are held for the whole copy. They are taken
+ * in address order so two copies going opposite ways can't deadlock.
+ * Copying a handle onto itself is rejected.
+ *
+ * Returns the number of bytes copied, which is short only at end of
+ * file or if the output stops taking data. An error after some bytes
+ * have been copied is dropped and the count returned instead, like a
+ * short write.
+ */
+int sys_copy_file_range(int infd, int outfd, size_t len, int32_t *retval)
+{
+    struct filehandle *in, *out;
+    struct lock *first, *second;
+    struct iovec iov;
+    struct uio u;
+    char *buf;
+    size_t done, chunk, got;
+    off_t inoff, outoff;
+    int result;
+
+    // Get the file handles from the file descriptor table; no lock needed
+    in = filetable_get(curproc->p_ft, infd);
+    out = filetable_get(curproc->p_ft, outfd);
+    if (in == NULL || out == NULL)
+    {
+        return EBADF;
+    }
+
+    // Check the access modes; they don't change once the file is open
+    if ((in->flags & O_ACCMODE) == O_WRONLY ||
+        (out->flags & O_ACCMODE) == O_RDONLY)
+    {
+        return EBADF;
+    }
+    if (in == out)
+    {
+        return EINVAL;
+    }
+
+    // The result has to fit in the return value
+    if (len > COPY_MAXTOTAL)
+    {
+        len = COPY_MAXTOTAL;
+    }
+
+    buf = kmalloc(COPY_CHUNK);
+    if (buf == NULL)
+    {
+        return ENOMEM;
+    }
+
+    // Lock both handles in a fixed order
+    if ((uintptr_t)in->fh_lock < (uintptr_t)out->fh_lock)
+    {
+        first = in->fh_lock;
+        second = out->fh_lock;
+    }
+    else
+    {
+        first = out->fh_lock;
+        second = in->fh_lock;
+    }
+    lock_acquire(first);
+    lock_acquire(second);
+
+    inoff = in->offset;
+    outoff = out->offset;
+    result = 0;
+    done = 0;
+    while (done < len)
+    {
+        // Stop the first chunk at a block boundary of the input
+        chunk = COPY_CHUNK - (size_t)(inoff % SFS_BLOCKSIZE);
+        if (chunk > len - done)
+        {
+            chunk = len - done;
+        }
+
+        // Read the next chunk into the kernel buffer
+        uio_kinit(&iov, &u, buf, chunk, inoff, UIO_READ);
+        result = VOP_READ(in->vn, &u);
+        if (result)
+        {
+            break;
+        }
+        got = chunk - u.uio_resid;
+        if (got == 0)
+        {
+            // End of file
+            break;
+        }
+        inoff = u.uio_offset;
+
+        // Write it back out
+        uio_kinit(&iov, &u, buf, got, outoff, UIO_WRITE);
+        result = VOP_WRITE(out->vn, &u);
+        outoff = u.uio_offset;
+        done += got - u.uio_resid;
+        if (result || u.uio_resid != 0)
+        {
+            // Don't skip over what was read but not written
+            inoff -= u.uio_resid;
+            break;
+        }
+    }
+
+    // Update the file offsets
+    in->offset = inoff;
+    out->offset = outoff;
+
+    lock_release(second);
+    lock_release(first);
+    kfree(buf);
+
+    if (result && done == 0)
+    {
+        return result;
+    }
+    *retval = done;
+    return 0;
+}
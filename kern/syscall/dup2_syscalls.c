@@ -14,7 +14,7 @@
 int sys_dup2(int oldfd, int newfd, int32_t *retval)
 {
     struct filetable *ft;
-    struct filehandle *old_fh, *new_fh;
+    int result;
 
     // Check validity of file descriptors
     if (oldfd < 0 || oldfd >= OPEN_MAX || newfd < 0 || newfd >= OPEN_MAX)
@@ -29,37 +29,32 @@ int sys_dup2(int oldfd, int newfd, int32_t *retval)
     // If oldfd and newfd are the same, return success immediately
     if (oldfd == newfd)
     {
+        if (filetable_get(ft, oldfd) == NULL)
+        {
+            return EBADF;
+        }
         *retval = newfd;
         return 0;
     }
 
-    // Acquire the lock for the file descriptor table
-    lock_acquire(ft->ft_lock);
-
-    // Get the file handle for oldfd
-    old_fh = ft->file_handles[oldfd];
-    if (old_fh == NULL)
+    if (filetable_get(ft, oldfd) == NULL)
     {
-        lock_release(ft->ft_lock);
         return EBADF;
     }
 
-    // Get the file handle for newfd
-    new_fh = ft->file_handles[newfd];
-
-    // Check if newfd is already open, if so, close it
-    if (new_fh != NULL)
+    // Get a table of our own, if we're sharing it since fork
+    result = filetable_unshare(&curproc->p_ft);
+    if (result)
     {
-        filehandle_decref(new_fh);
-        ft->file_handles[newfd] = NULL;
+        return result;
     }
 
-    // Add old_fh to newfd
-    ft->file_handles[newfd] = old_fh;
-    filehandle_incref(old_fh);
-
-    // Release the lock for the file decriptor table
-    lock_release(ft->ft_lock);
+    // Point newfd at oldfd's file handle, closing newfd first if it is open
+    result = filetable_dup(curproc->p_ft, oldfd, newfd);
+    if (result)
+    {
+        return result;
+    }
 
     // Set the return value
     *retval = newfd;
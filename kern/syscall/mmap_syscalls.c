@@ -0,0 +1,141 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/limits.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <filetable.h>
+#include <syscall.h>
+
+/*
+ * System call for mapping a file (or anonymous memory) into the
+ * address space. The kernel picks the address; addr is only a hint
+ * and is ignored. File pages come from the VM page cache, so every
+ * process mapping the same page of a file shares one frame.
+ */
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+             off_t offset, int32_t *retval)
+{
+    struct filetable *ft;
+    struct filehandle *fh;
+    struct addrspace *as;
+    struct vnode *vn;
+    vaddr_t base;
+    int perms, mapflags, accmode;
+    int result;
+
+    (void)addr;
+
+    // Exactly one of MAP_SHARED and MAP_PRIVATE, and nothing unknown
+    mapflags = flags & (MAP_SHARED | MAP_PRIVATE);
+    if (mapflags != MAP_SHARED && mapflags != MAP_PRIVATE)
+    {
+        return EINVAL;
+    }
+    if ((flags & ~(MAP_SHARED | MAP_PRIVATE | MAP_ANON)) != 0)
+    {
+        return EINVAL;
+    }
+    // Anonymous pages are copy-on-write across fork, so they can't be shared
+    if ((flags & MAP_ANON) && mapflags == MAP_SHARED)
+    {
+        return EINVAL;
+    }
+    if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0)
+    {
+        return EINVAL;
+    }
+
+    perms = RG_READ;
+    if (prot & PROT_WRITE)
+    {
+        perms |= RG_WRITE;
+    }
+    if (prot & PROT_EXEC)
+    {
+        perms |= RG_EXEC;
+    }
+
+    as = proc_getas();
+    if (as == NULL)
+    {
+        return EFAULT;
+    }
+
+    if (flags & MAP_ANON)
+    {
+        result = as_mmap(as, len, perms, NULL, 0, mapflags, &base);
+        if (result)
+        {
+            return result;
+        }
+        *retval = (int32_t)base;
+        return 0;
+    }
+
+    if (fd < 0 || fd >= OPEN_MAX)
+    {
+        return EBADF;
+    }
+
+    // Get the vnode from the file descriptor table
+    ft = curproc->p_ft;
+    KASSERT(ft != NULL);
+
+    fh = filetable_get(ft, fd);
+    if (fh == NULL)
+    {
+        return EBADF;
+    }
+    vn = fh->vn;
+    accmode = fh->flags & O_ACCMODE;
+    VOP_INCREF(vn);
+
+    // The file must be readable, and writable for shared writes
+    if (accmode == O_WRONLY ||
+        (mapflags == MAP_SHARED && (prot & PROT_WRITE) && accmode != O_RDWR))
+    {
+        VOP_DECREF(vn);
+        return EACCES;
+    }
+
+    result = VOP_MMAP(vn);
+    if (result)
+    {
+        VOP_DECREF(vn);
+        return result;
+    }
+
+    // The region takes its own reference
+    result = as_mmap(as, len, perms, vn, offset, mapflags, &base);
+    VOP_DECREF(vn);
+    if (result)
+    {
+        return result;
+    }
+
+    *retval = (int32_t)base;
+    return 0;
+}
+
+/*
+ * System call for removing mappings made with mmap.
+ * Shared, writable file pages are written back once nothing maps them.
+ */
+int sys_munmap(userptr_t addr, size_t len)
+{
+    struct addrspace *as;
+
+    as = proc_getas();
+    if (as == NULL)
+    {
+        return EINVAL;
+    }
+
+    return as_munmap(as, (vaddr_t)addr, len);
+}
@@ -25,6 +25,13 @@ int sys_open(const_userptr_t filename, int flags, mode_t mode, int32_t *retval)
         return result;      // Indicate failure
     }
 
+    /* Get a file table of our own, if we're sharing it since fork */
+    result = filetable_unshare(&curproc->p_ft);
+    if (result)
+    {
+        return result;
+    }
+
     /* Open the file */
     struct vnode *vn;
     result = vfs_open(kfilename, flags, mode, &vn);
@@ -42,7 +49,8 @@ int sys_open(const_userptr_t filename, int flags, mode_t mode, int32_t *retval)
     int fd = filetable_add(curproc->p_ft, fh);
     if (fd == -1)
     {
-        filehandle_decref(fh);
+        /* never referenced, so destroy it directly */
+        filehandle_destroy(fh);
         return EMFILE;      // Indicate failure
     }
 
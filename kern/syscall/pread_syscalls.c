@@ -0,0 +1,85 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/limits.h>
+#include <lib.h>
+#include <uio.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <filetable.h>
+#include <syscall.h>
+
+/*
+ * Positional I/O: pread and pwrite read or write at the given offset
+ * and leave the file handle's offset alone. Since the handle's offset
+ * is neither read nor updated, they don't take fh_lock, so threads and
+ * processes sharing a descriptor can do I/O on it at the same time.
+ * Any locking the file itself needs is up to the file system.
+ */
+static int positional_io(int fd, userptr_t buf_ptr, size_t nbytes, off_t offset,
+                         enum uio_rw rw, int32_t *retval)
+{
+    struct filehandle *fh;
+    struct iovec iov;
+    struct uio u;
+    int accmode;
+    int result;
+
+    // Get the file handle from the file descriptor table; no lock needed
+    fh = filetable_get(curproc->p_ft, fd);
+    if (fh == NULL)
+    {
+        return EBADF;
+    }
+
+    // Check the access mode; it doesn't change once the file is open
+    accmode = fh->flags & O_ACCMODE;
+    if (accmode == (rw == UIO_READ ? O_WRONLY : O_RDONLY))
+    {
+        return EBADF;
+    }
+
+    // An explicit offset only makes sense for a seekable object
+    if (!VOP_ISSEEKABLE(fh->vn))
+    {
+        return ESPIPE;
+    }
+    if (offset < 0)
+    {
+        return EINVAL;
+    }
+
+    // Set up the uio structure
+    uio_kinit(&iov, &u, (void *)buf_ptr, nbytes, offset, rw);
+    u.uio_segflg = UIO_USERSPACE;
+    u.uio_space = curproc->p_addrspace;
+
+    // Perform the operation
+    if (rw == UIO_READ)
+    {
+        result = VOP_READ(fh->vn, &u);
+    }
+    else
+    {
+        result = VOP_WRITE(fh->vn, &u);
+    }
+    if (result)
+    {
+        return result;
+    }
+
+    // Calculate the number of bytes actually transferred
+    *retval = nbytes - u.uio_resid;
+    return 0;
+}
+
+int sys_pread(int fd, userptr_t buf_ptr, size_t nbytes, off_t offset, int32_t *retval)
+{
+    return positional_io(fd, buf_ptr, nbytes, offset, UIO_READ, retval);
+}
+
+int sys_pwrite(int fd, const_userptr_t buf_ptr, size_t nbytes, off_t offset, int32_t *retval)
+{
+    return positional_io(fd, (userptr_t)buf_ptr, nbytes, offset, UIO_WRITE, retval);
+}
@@ -0,0 +1,141 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/iovec.h>
+#include <limits.h>
+#include <lib.h>
+#include <uio.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <vnode.h>
+#include <copyinout.h>
+#include <filetable.h>
+#include <syscall.h>
+
+/* Most callers pass a few iovecs; only bigger arrays are kmalloc'd. */
+#define READV_NSMALL 8
+
+/* Largest total length; the result has to fit in an ssize_t. */
+#define READV_MAXTOTAL 0x7fffffff
+
+/*
+ * Scatter/gather I/O. The user's iovec array is copied in and used as
+ * the uio's iovecs directly, so the whole transfer is one VOP_READ or
+ * VOP_WRITE; uiomove walks the iovecs as it goes. Otherwise this works
+ * like read and write, including using and updating the file offset
+ * under fh_lock.
+ */
+static int vector_io(int fd, const_userptr_t iov_ptr, int iovcnt,
+                     enum uio_rw rw, int32_t *retval)
+{
+    struct filehandle *fh;
+    struct iovec smalliov[READV_NSMALL];
+    struct iovec *iov;
+    struct uio u;
+    size_t total;
+    int result;
+    int i;
+
+    if (iovcnt <= 0 || iovcnt > IOV_MAX)
+    {
+        return EINVAL;
+    }
+
+    // Get the file handle from the file descriptor table; no lock needed
+    fh = filetable_get(curproc->p_ft, fd);
+    if (fh == NULL)
+    {
+        return EBADF;
+    }
+
+    // Copy in the iovec array; user and kernel iovecs have the same layout
+    if (iovcnt <= READV_NSMALL)
+    {
+        iov = smalliov;
+    }
+    else
+    {
+        iov = kmalloc(iovcnt * sizeof(struct iovec));
+        if (iov == NULL)
+        {
+            return ENOMEM;
+        }
+    }
+    result = copyin(iov_ptr, iov, iovcnt * sizeof(struct iovec));
+    if (result)
+    {
+        goto out;
+    }
+
+    // The total has to fit in the return value
+    total = 0;
+    for (i = 0; i < iovcnt; i++)
+    {
+        if (iov[i].iov_len > READV_MAXTOTAL - total)
+        {
+            result = EINVAL;
+            goto out;
+        }
+        total += iov[i].iov_len;
+    }
+
+    // Acquire the lock for the file handle
+    lock_acquire(fh->fh_lock);
+
+    // Check the access mode
+    if ((fh->flags & O_ACCMODE) == (rw == UIO_READ ? O_WRONLY : O_RDONLY))
+    {
+        lock_release(fh->fh_lock);
+        result = EBADF;
+        goto out;
+    }
+
+    // Set up the uio structure over all the iovecs
+    u.uio_iov = iov;
+    u.uio_iovcnt = iovcnt;
+    u.uio_offset = fh->offset;
+    u.uio_resid = total;
+    u.uio_segflg = UIO_USERSPACE;
+    u.uio_rw = rw;
+    u.uio_space = curproc->p_addrspace;
+
+    // Perform the operation
+    if (rw == UIO_READ)
+    {
+        result = VOP_READ(fh->vn, &u);
+    }
+    else
+    {
+        result = VOP_WRITE(fh->vn, &u);
+    }
+    if (result)
+    {
+        lock_release(fh->fh_lock);
+        goto out;
+    }
+
+    // Update the file offset
+    fh->offset = u.uio_offset;
+    *retval = total - u.uio_resid;
+
+    // Release the lock for the file handle
+    lock_release(fh->fh_lock);
+
+out:
+    if (iov != smalliov)
+    {
+        kfree(iov);
+    }
+    return result;
+}
+
+int sys_readv(int fd, const_userptr_t iov_ptr, int iovcnt, int32_t *retval)
+{
+    return vector_io(fd, iov_ptr, iovcnt, UIO_READ, retval);
+}
+
+int sys_writev(int fd, const_userptr_t iov_ptr, int iovcnt, int32_t *retval)
+{
+    return vector_io(fd, iov_ptr, iovcnt, UIO_WRITE, retval);
+}
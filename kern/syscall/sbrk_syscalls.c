@@ -0,0 +1,33 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <syscall.h>
+
+/*
+ * System call for growing or shrinking the heap.
+ * Moves the break by amount bytes and returns the old break.
+ * Pages dropped off the end of the heap go back to the coremap.
+ */
+int sys_sbrk(intptr_t amount, int32_t *retval)
+{
+    struct addrspace *as;
+    vaddr_t oldbreak;
+    int result;
+
+    as = proc_getas();
+    if (as == NULL)
+    {
+        return ENOMEM;
+    }
+
+    result = as_sbrk(as, amount, &oldbreak);
+    if (result)
+    {
+        return result;
+    }
+
+    *retval = (int32_t)oldbreak;
+    return 0;
+}
@@ -33,18 +33,15 @@ int sys_write(int fd, const_userptr_t buf_ptr, size_t nbytes, int32_t *retval)
     ft = curproc->p_ft;
     KASSERT(ft != NULL);
 
-    // Get the file handle from the file descriptor table
-    lock_acquire(ft->ft_lock);
-    fh = ft->file_handles[fd];
+    // Get the file handle from the file descriptor table; no lock needed
+    fh = filetable_get(ft, fd);
     if (fh == NULL)
     {
-        lock_release(ft->ft_lock);
         return EBADF;
     }
 
     // lock the file handle
     lock_acquire(fh->fh_lock);
-    lock_release(ft->ft_lock);
 
     // Check if the file is opened for writing
     if ((fh->flags & O_ACCMODE) == O_RDONLY)
@@ -34,6 +34,7 @@
 #include <types.h>
 #include <lib.h>
 #include <clock.h>
+#include <spinlock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -399,3 +400,155 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Reader-writer lock test.
+ *
+ * One thread in four is a writer, which updates testval1-3 together;
+ * the rest are readers, which check that the three agree. Both yield
+ * while holding the lock to invite the others in. Readers count how
+ * many of them are inside at once, which should be more than one, and
+ * writers check that they are alone.
+ */
+
+#define NRWLOOPS 40
+
+static struct rwlock *testrwlock;
+static struct spinlock rwcount_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned rwreaders;
+static volatile unsigned rwmaxreaders;
+static volatile bool rwwriting;
+static volatile unsigned rwfailures;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	spinlock_acquire(&rwcount_lock);
+	rwfailures++;
+	spinlock_release(&rwcount_lock);
+}
+
+static
+void
+rwtestreader(unsigned long num)
+{
+	unsigned long v1;
+
+	rwlock_acquire_read(testrwlock);
+
+	spinlock_acquire(&rwcount_lock);
+	rwreaders++;
+	if (rwreaders > rwmaxreaders) {
+		rwmaxreaders = rwreaders;
+	}
+	spinlock_release(&rwcount_lock);
+
+	if (rwwriting) {
+		rwfail(num, "reader got in with a writer");
+	}
+	v1 = testval1;
+	if (testval2 != v1*v1 || testval3 != v1%3) {
+		rwfail(num, "reader saw a partial write");
+	}
+	thread_yield();
+	if (testval1 != v1) {
+		rwfail(num, "value changed under a reader");
+	}
+
+	spinlock_acquire(&rwcount_lock);
+	rwreaders--;
+	spinlock_release(&rwcount_lock);
+
+	rwlock_release_read(testrwlock);
+}
+
+static
+void
+rwtestwriter(unsigned long num)
+{
+	rwlock_acquire_write(testrwlock);
+
+	if (rwwriting) {
+		rwfail(num, "two writers at once");
+	}
+	rwwriting = true;
+	if (rwreaders != 0) {
+		rwfail(num, "writer got in with readers");
+	}
+	testval1 = num;
+	thread_yield();
+	testval2 = num*num;
+	testval3 = num%3;
+	if (testval1 != num) {
+		rwfail(num, "value changed under a writer");
+	}
+	rwwriting = false;
+
+	rwlock_release_write(testrwlock);
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % 4 == 0) {
+			rwtestwriter(num);
+		}
+		else {
+			rwtestreader(num);
+		}
+	}
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	if (testrwlock == NULL) {
+		testrwlock = rwlock_create("testrwlock");
+		if (testrwlock == NULL) {
+			panic("rwtest: rwlock_create failed\n");
+		}
+	}
+	kprintf("Starting rwlock test...\n");
+
+	testval1 = testval2 = testval3 = 0;
+	rwreaders = rwmaxreaders = rwfailures = 0;
+	rwwriting = false;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("rwtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	kprintf("Up to %u readers held the lock at once\n", rwmaxreaders);
+	if (rwfailures > 0) {
+		kprintf("Test failed\n");
+	}
+	else if (rwmaxreaders < 2) {
+		kprintf("Test failed: readers never shared the lock\n");
+	}
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
@@ -28,8 +28,11 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spinlock.h>
+#include <synch.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
@@ -38,9 +41,12 @@
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Besides hardclock, which drives the scheduler, there are timeouts:
+ * callbacks scheduled for a particular time of day. They are kept in
+ * a leftist heap, soonest first, and the timer device that runs
+ * timerclock() is set up as a one-shot timer to interrupt exactly when
+ * the next one is due (or at the next second, for lbolt), so they have
+ * the device's microsecond resolution instead of hardclock's.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -59,6 +65,16 @@
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
 
+/*
+ * Timeout state. timerclock_next is when lbolt is next due;
+ * timerclock_arm and timerclock_dev are the timer device, if any.
+ */
+static struct spinlock timeout_lock;
+static struct timeout *timeout_heap;
+static struct timespec timerclock_next;
+static void (*timerclock_arm)(void *dev, uint32_t usecs);
+static void *timerclock_dev;
+
 /*
  * Setup.
  */
@@ -70,19 +86,166 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	spinlock_init(&timeout_lock);
 }
 
 /*
- * This is called once per second, on one processor, by the timer
- * code.
+ * Merge two timeout heaps. The recursion only follows right spines,
+ * which in a leftist heap are at most log2(n) long.
+ */
+static
+struct timeout *
+timeout_merge(struct timeout *a, struct timeout *b)
+{
+	struct timeout *t;
+
+	if (a == NULL) {
+		return b;
+	}
+	if (b == NULL) {
+		return a;
+	}
+	if (timespec_cmp(&b->to_when, &a->to_when) < 0) {
+		t = a;
+		a = b;
+		b = t;
+	}
+	a->to_right = timeout_merge(a->to_right, b);
+	if (a->to_left == NULL || a->to_left->to_rank < a->to_right->to_rank) {
+		t = a->to_left;
+		a->to_left = a->to_right;
+		a->to_right = t;
+	}
+	a->to_rank = (a->to_right == NULL ? 0 : a->to_right->to_rank) + 1;
+	return a;
+}
+
+/*
+ * Set the timer device to go off at the earliest of the pending
+ * timeouts and the next lbolt. The device takes at most a second.
+ */
+static
+void
+timerclock_rearm(const struct timespec *now)
+{
+	const struct timespec *next;
+	struct timespec delta;
+	uint32_t usecs;
+
+	KASSERT(spinlock_do_i_hold(&timeout_lock));
+
+	if (timerclock_arm == NULL) {
+		return;
+	}
+
+	next = &timerclock_next;
+	if (timeout_heap != NULL &&
+	    timespec_cmp(&timeout_heap->to_when, next) < 0) {
+		next = &timeout_heap->to_when;
+	}
+
+	if (timespec_cmp(next, now) <= 0) {
+		usecs = 1;
+	}
+	else {
+		timespec_sub(next, now, &delta);
+		if (delta.tv_sec > 0) {
+			usecs = 1000000;
+		}
+		else {
+			usecs = (delta.tv_nsec + 999) / 1000;
+		}
+	}
+	timerclock_arm(timerclock_dev, usecs);
+}
+
+/*
+ * Called by the timer device driver to hand over the device. ARM
+ * should make the device interrupt once, after USECS microseconds;
+ * the driver calls timerclock() when it does.
+ */
+void
+timerclock_attach(void (*arm)(void *dev, uint32_t usecs), void *dev)
+{
+	KASSERT(timerclock_arm == NULL);
+
+	spinlock_acquire(&timeout_lock);
+	timerclock_arm = arm;
+	timerclock_dev = dev;
+	/* The clock may not be attached yet; just wait a second. */
+	arm(dev, 1000000);
+	spinlock_release(&timeout_lock);
+}
+
+/*
+ * Schedule TO->to_func(TO->to_data) to be called at TO->to_when.
+ */
+void
+timeout_add(struct timeout *to)
+{
+	struct timespec now;
+
+	to->to_left = NULL;
+	to->to_right = NULL;
+	to->to_rank = 1;
+
+	gettime(&now);
+	spinlock_acquire(&timeout_lock);
+	timeout_heap = timeout_merge(timeout_heap, to);
+	if (timeout_heap == to) {
+		/* It's the new soonest; the device has to know. */
+		timerclock_rearm(&now);
+	}
+	spinlock_release(&timeout_lock);
+}
+
+/*
+ * This is called, on one processor, by the timer device each time it
+ * goes off. Run the timeouts that are due, and once a second
+ * broadcast on lbolt; then set the device for the next of these.
  */
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
+	static const struct timespec onesec = { .tv_sec = 1, .tv_nsec = 0 };
+	struct timespec now;
+	struct timeout *due, *to;
+	bool tick;
+
+	gettime(&now);
+
+	/* Collect the expired timeouts on a list linked through to_left. */
+	due = NULL;
+	spinlock_acquire(&timeout_lock);
+	while (timeout_heap != NULL &&
+	       timespec_cmp(&timeout_heap->to_when, &now) <= 0) {
+		to = timeout_heap;
+		timeout_heap = timeout_merge(to->to_left, to->to_right);
+		to->to_left = due;
+		due = to;
+	}
+	tick = timespec_cmp(&timerclock_next, &now) <= 0;
+	if (tick) {
+		timespec_add(&timerclock_next, &onesec, &timerclock_next);
+		if (timespec_cmp(&timerclock_next, &now) <= 0) {
+			/* First time, or the time of day was reset. */
+			timespec_add(&now, &onesec, &timerclock_next);
+		}
+	}
+	timerclock_rearm(&now);
+	spinlock_release(&timeout_lock);
+
+	while (due != NULL) {
+		to = due;
+		due = to->to_left;
+		to->to_func(to->to_data);
+	}
+
+	if (tick) {
+		spinlock_acquire(&lbolt_lock);
+		wchan_wakeall(lbolt, &lbolt_lock);
+		spinlock_release(&lbolt_lock);
+	}
 }
 
 /*
@@ -103,7 +266,7 @@ hardclock(void)
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	thread_tick();
 }
 
 /*
@@ -119,3 +282,39 @@ clocksleep(int num_secs)
 	}
 	spinlock_release(&lbolt_lock);
 }
+
+/*
+ * Timeout function for clocksleep_until.
+ */
+static
+void
+clocksleep_wakeup(void *vsem)
+{
+	struct semaphore *sem = vsem;
+
+	V(sem);
+}
+
+/*
+ * Suspend execution until the time of day reaches WHEN.
+ */
+int
+clocksleep_until(const struct timespec *when)
+{
+	struct semaphore *sem;
+	struct timeout to;
+
+	sem = sem_create("clocksleep", 0);
+	if (sem == NULL) {
+		return ENOMEM;
+	}
+
+	to.to_when = *when;
+	to.to_func = clocksleep_wakeup;
+	to.to_data = sem;
+	timeout_add(&to);
+
+	P(sem);
+	sem_destroy(sem);
+	return 0;
+}
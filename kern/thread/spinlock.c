@@ -43,6 +43,9 @@
  * Spinlocks.
  */
 
+/* List of all attached statistics. Only ever grows. */
+static struct spinlock_stats *spinlock_allstats;
+static struct spinlock spinlock_allstats_lock = SPINLOCK_INITIALIZER;
 
 /*
  * Initialize spinlock.
@@ -51,7 +54,20 @@ void
 spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_next, 0);
 	splk->splk_holder = NULL;
+	splk->splk_ticket = false;
+	splk->splk_stats = NULL;
+}
+
+/*
+ * Initialize a ticket spinlock.
+ */
+void
+spinlock_init_ticket(struct spinlock *splk)
+{
+	spinlock_init(splk);
+	splk->splk_ticket = true;
 }
 
 /*
@@ -61,7 +77,13 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	if (splk->splk_ticket) {
+		KASSERT(spinlock_data_get(&splk->splk_lock) ==
+			spinlock_data_get(&splk->splk_next));
+	}
+	else {
+		KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	}
 }
 
 /*
@@ -75,6 +97,9 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	struct spinlock_stats *ss;
+	spinlock_data_t ticket;
+	unsigned spins;
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -90,28 +115,51 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
+	spins = 0;
+	if (splk->splk_ticket) {
 		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
+		 * Take the next ticket and wait for it to be served.
+		 * Only the holder writes the lock word, so all we do
+		 * while waiting is read it.
 		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
+		ticket = spinlock_data_fetchinc(&splk->splk_next);
+		while (spinlock_data_get(&splk->splk_lock) != ticket) {
+			spins++;
 		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
+	}
+	else {
+		while (1) {
+			/*
+			 * Do test-test-and-set, that is, read first
+			 * before doing test-and-set, to reduce bus
+			 * contention.
+			 *
+			 * Test-and-set is a machine-level atomic
+			 * operation that writes 1 into the lock word
+			 * and returns the previous value. If that
+			 * value was 0, the lock was previously unheld
+			 * and we now own it. If it was 1, we don't.
+			 */
+			if (spinlock_data_get(&splk->splk_lock) == 0 &&
+			    spinlock_data_testandset(&splk->splk_lock) == 0) {
+				break;
+			}
+			spins++;
 		}
-		break;
 	}
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+
+	ss = splk->splk_stats;
+	if (ss != NULL) {
+		ss->ss_acquires++;
+		if (spins > 0) {
+			ss->ss_contended++;
+			ss->ss_spins += spins;
+		}
+		ss->ss_holdstart = cpu_cycles();
+	}
 }
 
 /*
@@ -120,6 +168,9 @@ spinlock_acquire(struct spinlock *splk)
 void
 spinlock_release(struct spinlock *splk)
 {
+	struct spinlock_stats *ss;
+	uint32_t now;
+
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
 		KASSERT(splk->splk_holder == curcpu->c_self);
@@ -127,9 +178,25 @@ spinlock_release(struct spinlock *splk)
 		curcpu->c_spinlocks--;
 	}
 
+	ss = splk->splk_stats;
+	if (ss != NULL) {
+		now = cpu_cycles();
+		if (now >= ss->ss_holdstart &&
+		    now - ss->ss_holdstart > ss->ss_maxhold) {
+			ss->ss_maxhold = now - ss->ss_holdstart;
+		}
+	}
+
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	if (splk->splk_ticket) {
+		/* Serve the next ticket. */
+		spinlock_data_set(&splk->splk_lock,
+				  spinlock_data_get(&splk->splk_lock) + 1);
+	}
+	else {
+		spinlock_data_set(&splk->splk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -146,3 +213,66 @@ spinlock_do_i_hold(struct spinlock *splk)
 	/* Assume we can read splk_holder atomically enough for this to work */
 	return (splk->splk_holder == curcpu->c_self);
 }
+
+/*
+ * Start keeping statistics for a lock in SS.
+ *
+ * Take the lock while hooking it up, so that nobody is in the middle
+ * of a critical section that started without statistics.
+ */
+void
+spinlock_stats_attach(struct spinlock *splk, struct spinlock_stats *ss,
+		      const char *name)
+{
+	bzero(ss, sizeof(*ss));
+	snprintf(ss->ss_name, sizeof(ss->ss_name), "%s", name);
+
+	spinlock_acquire(&spinlock_allstats_lock);
+	ss->ss_next = spinlock_allstats;
+	membar_store_store();
+	spinlock_allstats = ss;
+	spinlock_release(&spinlock_allstats_lock);
+
+	spinlock_acquire(splk);
+	KASSERT(splk->splk_stats == NULL);
+	splk->splk_stats = ss;
+	ss->ss_holdstart = cpu_cycles();
+	spinlock_release(splk);
+}
+
+/*
+ * Print the statistics. The counters are read without locking, so a
+ * line may be a little out of date by the time it's printed.
+ */
+void
+spinlock_stats_print(void)
+{
+	struct spinlock_stats *ss;
+
+	kprintf("%-23s %10s %10s %12s %10s\n",
+		"lock", "acquires", "contended", "spins", "maxhold");
+	for (ss = spinlock_allstats; ss != NULL; ss = ss->ss_next) {
+		kprintf("%-23s %10llu %10llu %12llu %10u\n", ss->ss_name,
+			(unsigned long long)ss->ss_acquires,
+			(unsigned long long)ss->ss_contended,
+			(unsigned long long)ss->ss_spins,
+			ss->ss_maxhold);
+	}
+}
+
+/*
+ * Clear the statistics. As with printing, this is done without
+ * locking; an update that races with it may survive.
+ */
+void
+spinlock_stats_reset(void)
+{
+	struct spinlock_stats *ss;
+
+	for (ss = spinlock_allstats; ss != NULL; ss = ss->ss_next) {
+		ss->ss_acquires = 0;
+		ss->ss_contended = 0;
+		ss->ss_spins = 0;
+		ss->ss_maxhold = 0;
+	}
+}
@@ -33,11 +33,15 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <spl.h>
+#include <membar.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <kmem.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
@@ -138,13 +142,65 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Locks come from an object cache. A free lock keeps its spinlock and
+ * wait channel, so creating a lock doesn't have to make a new wait
+ * channel (and take the global wchan list lock) every time.
+ */
+static struct kmem_cache *lock_cache;
+
+static int
+lock_ctor(void *obj)
+{
+        struct lock *lock = obj;
+        unsigned i;
+
+        spinlock_init(&lock->lk_spinlock);
+        lock->lk_wchan = wchan_create("lock");
+        if (lock->lk_wchan == NULL)
+        {
+                spinlock_cleanup(&lock->lk_spinlock);
+                return ENOMEM;
+        }
+        lock->lk_holder = NULL;
+        spinlock_data_set(&lock->lk_hold, 0);
+        lock->lk_waiters = 0;
+        for (i = 0; i < SCHED_NPRIO; i++)
+        {
+                lock->lk_waitprio[i] = 0;
+        }
+        lock->lk_piowner = NULL;
+        lock->lk_pinext = NULL;
+        return 0;
+}
+
+static void
+lock_dtor(void *obj)
+{
+        struct lock *lock = obj;
+
+        wchan_destroy(lock->lk_wchan);
+        spinlock_cleanup(&lock->lk_spinlock);
+}
+
+/* Set up the lock cache. Called once during system startup. */
+void synch_bootstrap(void)
+{
+        lock_cache = kmem_cache_create("lock", sizeof(struct lock),
+                                       lock_ctor, lock_dtor);
+        if (lock_cache == NULL)
+        {
+                panic("synch_bootstrap: Out of memory\n");
+        }
+}
+
 /* Create the lock. */
 struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
 
-        lock = kmalloc(sizeof(struct lock));
+        lock = kmem_cache_alloc(lock_cache);
         if (lock == NULL)
         {
                 return NULL;
@@ -153,24 +209,17 @@ lock_create(const char *name)
         lock->lk_name = kstrdup(name);
         if (lock->lk_name == NULL)
         {
-                kfree(lock);
+                kmem_cache_free(lock_cache, lock);
                 return NULL;
         }
 
-        // add stuff here as needed
+        /* the spinlock and wait channel are already set up */
+        wchan_setname(lock->lk_wchan, lock->lk_name);
 
-        spinlock_init(&lock->lk_spinlock);            /* initialize spinlock */
-        lock->lk_wchan = wchan_create(lock->lk_name); /* create wait channel */
-        /* if failing to create wait channel, free the lock */
-        if (lock->lk_wchan == NULL)
-        {
-                kfree(lock->lk_name);
-                kfree(lock);
-                return NULL;
-        }
         /* initially no thread is holding the lock */
-        lock->lk_holder = NULL;
-        lock->lk_hold = 0;
+        KASSERT(lock->lk_holder == NULL);
+        KASSERT(spinlock_data_get(&lock->lk_hold) == 0);
+        KASSERT(lock->lk_waiters == 0);
 
         return lock;
 }
@@ -180,76 +229,366 @@ void lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
 
-        // add stuff here as needed
-
         /* acquire the spinlock making sure no other threads can modify the lock */
         spinlock_acquire(&lock->lk_spinlock);
 
-        KASSERT(!lock->lk_hold);                                    /* make sure the lock is not used */
+        KASSERT(!spinlock_data_get(&lock->lk_hold));                /* make sure the lock is not used */
         KASSERT(lock->lk_holder == NULL);                           /* make sure no thread is holding the lock */
+        KASSERT(lock->lk_waiters == 0);                             /* make sure no thread is waiting */
+        KASSERT(lock->lk_piowner == NULL);                          /* make sure nobody inherits through it */
         KASSERT(wchan_isempty(lock->lk_wchan, &lock->lk_spinlock)); /* make sure wait channel is empty */
 
         spinlock_release(&lock->lk_spinlock);
 
-        wchan_destroy(lock->lk_wchan);        /* destroy the wait channel */
-        spinlock_cleanup(&lock->lk_spinlock); /* clean up the spinlock */
-
-        /* clean up the lock structure */
+        /* the name is about to go away; hand the lock back to the cache */
+        wchan_setname(lock->lk_wchan, "lock");
         kfree(lock->lk_name);
-        kfree(lock);
+        kmem_cache_free(lock_cache, lock);
+}
+
+/*
+ * Try to take the lock without waiting. Interrupts are off between
+ * the test-and-set and setting lk_holder, so that other threads only
+ * ever see the lock held with no holder for a moment.
+ */
+static bool
+lock_tryget(struct lock *lock)
+{
+        int spl;
+
+        spl = splhigh();
+        while (spinlock_data_get(&lock->lk_hold) == 0)
+        {
+                /* testandset can fail spuriously; go around again */
+                if (spinlock_data_testandset(&lock->lk_hold) == 0)
+                {
+                        membar_store_any();
+                        lock->lk_holder = curthread;
+                        splx(spl);
+                        return true;
+                }
+        }
+        splx(spl);
+        return false;
+}
+
+/*
+ * Wait for the lock by spinning, for as long as that is a better bet
+ * than going to sleep: that is, while the holder is running on another
+ * cpu, and so may let go any moment. Returns true if the lock looks
+ * free, false if it's time to sleep.
+ *
+ * The holder may exit and its thread structure be reused once it lets
+ * go of the lock, so we only go by what we read from it while it is
+ * still lk_holder. (Kernel memory is always mapped, so reading it is
+ * harmless either way.)
+ */
+static bool
+lock_spin(struct lock *lock)
+{
+        struct thread *holder;
+        bool running;
+
+        while (spinlock_data_get(&lock->lk_hold) != 0)
+        {
+                holder = lock->lk_holder;
+                if (holder == NULL)
+                {
+                        /* just being taken or released */
+                        continue;
+                }
+                running = holder->t_state == S_RUN;
+                membar_load_load();
+                if (!running && lock->lk_holder == holder)
+                {
+                        return false;
+                }
+        }
+        return true;
+}
+
+/*
+ * Priority inheritance.
+ *
+ * A thread that goes to sleep on a lock lends its priority to the
+ * holder, so that a low-priority holder can't keep a high-priority
+ * waiter waiting behind everything in between. Each lock counts its
+ * sleeping waiters at each priority level in lk_waitprio; a lock with
+ * any is on its holder's t_pilocks list, and the holder's t_inherit is
+ * the best level waiting on any lock on that list. If the holder is
+ * itself asleep on another lock, the priority is passed along to that
+ * lock's holder, and so on.
+ *
+ * All of this is protected by pi_lock, which is only taken on slow
+ * paths: by a waiter going to sleep, and by lock_acquire and
+ * lock_release when lk_waiters says someone is waiting. A waiter
+ * counts itself in lk_waiters before looking at lk_holder, and a
+ * releaser clears lk_holder before looking at lk_waiters, so a waiter
+ * that finds a holder to lend its priority to is always seen by that
+ * holder's lock_release, which takes it back.
+ *
+ * The holder can't exit while a waiter is looking at it: its
+ * lock_release has to get pi_lock first.
+ */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+/* Bound on how far priority is passed along a chain of locks. */
+#define PI_MAXDEPTH 8
+
+/* Return the best priority waiting on LOCK, or SCHED_NPRIO if none. */
+static unsigned
+pi_lockprio(struct lock *lock)
+{
+        unsigned i;
+
+        for (i = 0; i < SCHED_NPRIO; i++)
+        {
+                if (lock->lk_waitprio[i] > 0)
+                {
+                        break;
+                }
+        }
+        return i;
+}
+
+/* Take LOCK off the t_pilocks list it is on. */
+static void
+pi_unlink(struct lock *lock)
+{
+        struct lock **lp;
+
+        KASSERT(spinlock_do_i_hold(&pi_lock));
+        KASSERT(lock->lk_piowner != NULL);
+
+        for (lp = &lock->lk_piowner->t_pilocks; *lp != lock; lp = &(*lp)->lk_pinext)
+        {
+                KASSERT(*lp != NULL);
+        }
+        *lp = lock->lk_pinext;
+        lock->lk_pinext = NULL;
+        lock->lk_piowner = NULL;
+}
+
+/* Put LOCK on T's t_pilocks list, moving it from another if need be. */
+static void
+pi_link(struct lock *lock, struct thread *t)
+{
+        KASSERT(spinlock_do_i_hold(&pi_lock));
+
+        if (lock->lk_piowner == t)
+        {
+                return;
+        }
+        if (lock->lk_piowner != NULL)
+        {
+                /* a previous holder that hasn't got to lock_release yet */
+                pi_unlink(lock);
+        }
+        lock->lk_piowner = t;
+        lock->lk_pinext = t->t_pilocks;
+        t->t_pilocks = lock;
+}
+
+/*
+ * Work out what T inherits from its locks, and if that changed and T
+ * is asleep on a lock itself, pass the change along.
+ */
+static void
+pi_update(struct thread *t)
+{
+        struct lock *lock;
+        unsigned prio, depth;
+
+        KASSERT(spinlock_do_i_hold(&pi_lock));
+
+        for (depth = 0; t != NULL && depth < PI_MAXDEPTH; depth++)
+        {
+                prio = SCHED_NPRIO;
+                for (lock = t->t_pilocks; lock != NULL; lock = lock->lk_pinext)
+                {
+                        if (pi_lockprio(lock) < prio)
+                        {
+                                prio = pi_lockprio(lock);
+                        }
+                }
+                if (prio == t->t_inherit)
+                {
+                        return;
+                }
+                thread_inherit(t, prio);
+
+                lock = t->t_waitlock;
+                if (lock == NULL)
+                {
+                        return;
+                }
+                prio = thread_getpriority(t);
+                if (prio == t->t_waitprio)
+                {
+                        return;
+                }
+                lock->lk_waitprio[t->t_waitprio]--;
+                lock->lk_waitprio[prio]++;
+                t->t_waitprio = prio;
+
+                t = lock->lk_holder;
+                if (t != NULL)
+                {
+                        pi_link(lock, t);
+                }
+        }
+}
+
+/*
+ * The current thread is about to sleep on LOCK: count it as a waiter
+ * at its priority, and lend that to the holder.
+ */
+static void
+pi_block(struct lock *lock)
+{
+        struct thread *holder;
+
+        spinlock_acquire(&pi_lock);
+        if (curthread->t_waitlock == NULL)
+        {
+                curthread->t_waitlock = lock;
+                curthread->t_waitprio = thread_getpriority(curthread);
+                lock->lk_waitprio[curthread->t_waitprio]++;
+        }
+        KASSERT(curthread->t_waitlock == lock);
+        holder = lock->lk_holder;
+        if (holder != NULL)
+        {
+                pi_link(lock, holder);
+                pi_update(holder);
+        }
+        spinlock_release(&pi_lock);
+}
+
+/*
+ * The current thread has got LOCK and someone else may be waiting for
+ * it: stop counting ourselves as a waiter, and inherit from the rest.
+ */
+static void
+pi_acquired(struct lock *lock)
+{
+        spinlock_acquire(&pi_lock);
+        if (curthread->t_waitlock == lock)
+        {
+                lock->lk_waitprio[curthread->t_waitprio]--;
+                curthread->t_waitlock = NULL;
+        }
+        if (pi_lockprio(lock) < SCHED_NPRIO)
+        {
+                pi_link(lock, curthread);
+        }
+        pi_update(curthread);
+        spinlock_release(&pi_lock);
+}
+
+/*
+ * The current thread has let go of LOCK, which someone may be waiting
+ * for: give back what was lent for it.
+ */
+static void
+pi_released(struct lock *lock)
+{
+        spinlock_acquire(&pi_lock);
+        if (lock->lk_piowner == curthread)
+        {
+                pi_unlink(lock);
+        }
+        pi_update(curthread);
+        spinlock_release(&pi_lock);
 }
 
 /*
  * Get the lock. Only one thread can hold the lock at the same time.
- * If the lock is held by another thread, put the current thread to sleep.
+ *
+ * An uncontended lock is taken with a single test-and-set, without the
+ * spinlock or the wait channel. If the lock is held by a thread that is
+ * running on another cpu, spin until it lets go; otherwise, put the
+ * current thread to sleep.
  */
 void lock_acquire(struct lock *lock)
 {
-        // Write this
-
         KASSERT(lock != NULL);
         /* must not acquire the lock in an interrupt handler */
         KASSERT(!curthread->t_in_interrupt);
+        /* must not already hold it */
+        KASSERT(lock->lk_holder != curthread);
 
-        /* acquire the spinlock, protecting the lock and the wait channel */
-        spinlock_acquire(&lock->lk_spinlock);
+        /* fast path, then spinning */
+        while (!lock_tryget(lock))
+        {
+                if (!lock_spin(lock))
+                {
+                        break;
+                }
+        }
+        if (lock->lk_holder == curthread)
+        {
+                /* if anyone is asleep waiting, take on their priority */
+                membar_any_any();
+                if (lock->lk_waiters > 0)
+                {
+                        pi_acquired(lock);
+                }
+                return;
+        }
 
-        /* if the lock is held by other threads, put the current thread to sleep */
-        while (lock->lk_hold)
+        /*
+         * Slow path: sleep. Count ourselves as a waiter before the
+         * last look at the lock, so that a release that happens after
+         * that look knows to wake us up.
+         */
+        spinlock_acquire(&lock->lk_spinlock);
+        lock->lk_waiters++;
+        while (!lock_tryget(lock))
         {
+                pi_block(lock);
                 /*
                  * wchan_sleep would unlocks the spinlock before sleeping, and
                  * acquire the spinlock again before returning.
                  */
                 wchan_sleep(lock->lk_wchan, &lock->lk_spinlock);
         }
-
-        /* acquire the lock for the current thread */
-        lock->lk_hold = 1;
-        lock->lk_holder = curthread;
-
+        lock->lk_waiters--;
+        if (curthread->t_waitlock != NULL || lock->lk_waiters > 0)
+        {
+                pi_acquired(lock);
+        }
         spinlock_release(&lock->lk_spinlock);
 }
 
-/* Free the lock. Only the thread holding the lock can do this. */
+/*
+ * Free the lock. Only the thread holding the lock can do this. The
+ * spinlock and wait channel are only touched if someone is waiting.
+ */
 void lock_release(struct lock *lock)
 {
-        // Write this
+        int spl;
 
         KASSERT(lock != NULL);
         /* make sure the current thread is holding the lock */
         KASSERT(lock_do_i_hold(lock));
 
-        /* acquire the spinlock, protecting the lock and the wait channel */
-        spinlock_acquire(&lock->lk_spinlock);
-
         /* free the lock */
-        lock->lk_hold = 0;
+        spl = splhigh();
         lock->lk_holder = NULL;
-        /* wake up a thread waiting on the wait channel */
-        wchan_wakeone(lock->lk_wchan, &lock->lk_spinlock);
+        membar_any_store();
+        spinlock_data_set(&lock->lk_hold, 0);
+        splx(spl);
 
-        spinlock_release(&lock->lk_spinlock);
+        /* wake up a thread waiting on the wait channel, if any */
+        membar_any_any();
+        if (lock->lk_waiters > 0)
+        {
+                pi_released(lock);
+                spinlock_acquire(&lock->lk_spinlock);
+                wchan_wakeone(lock->lk_wchan, &lock->lk_spinlock);
+                spinlock_release(&lock->lk_spinlock);
+        }
 }
 
 /*
@@ -268,12 +607,8 @@ bool lock_do_i_hold(struct lock *lock)
                 return false;
         }
 
-        /* acquire the spinlock before checking whether the current threads holds the lock */
-        spinlock_acquire(&lock->lk_spinlock);
-        bool do_i_hold = (lock->lk_holder == curthread);
-        spinlock_release(&lock->lk_spinlock);
-
-        return do_i_hold;
+        /* only we can make this true or stop it being true */
+        return lock->lk_holder == curthread;
 }
 
 ////////////////////////////////////////////////////////////
@@ -403,3 +738,148 @@ void cv_broadcast(struct cv *cv, struct lock *lock)
 
         spinlock_release(&cv->cv_lock);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+/* Create the rwlock. */
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rwlock;
+
+        rwlock = kmalloc(sizeof(struct rwlock));
+        if (rwlock == NULL)
+        {
+                return NULL;
+        }
+
+        rwlock->rwlock_name = kstrdup(name);
+        if (rwlock->rwlock_name == NULL)
+        {
+                kfree(rwlock);
+                return NULL;
+        }
+
+        rwlock->rw_readwchan = wchan_create(rwlock->rwlock_name);
+        if (rwlock->rw_readwchan == NULL)
+        {
+                kfree(rwlock->rwlock_name);
+                kfree(rwlock);
+                return NULL;
+        }
+        rwlock->rw_writewchan = wchan_create(rwlock->rwlock_name);
+        if (rwlock->rw_writewchan == NULL)
+        {
+                wchan_destroy(rwlock->rw_readwchan);
+                kfree(rwlock->rwlock_name);
+                kfree(rwlock);
+                return NULL;
+        }
+        spinlock_init(&rwlock->rw_lock);
+
+        /* initially nobody holds or wants the lock */
+        rwlock->rw_readers = 0;
+        rwlock->rw_writerswaiting = 0;
+        rwlock->rw_writer = NULL;
+
+        return rwlock;
+}
+
+/* Clean up the rwlock. */
+void rwlock_destroy(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+
+        /* make sure nobody holds or wants the lock */
+        spinlock_acquire(&rwlock->rw_lock);
+        KASSERT(rwlock->rw_readers == 0);
+        KASSERT(rwlock->rw_writerswaiting == 0);
+        KASSERT(rwlock->rw_writer == NULL);
+        KASSERT(wchan_isempty(rwlock->rw_readwchan, &rwlock->rw_lock));
+        spinlock_release(&rwlock->rw_lock);
+
+        wchan_destroy(rwlock->rw_writewchan);
+        wchan_destroy(rwlock->rw_readwchan);
+        spinlock_cleanup(&rwlock->rw_lock);
+
+        kfree(rwlock->rwlock_name);
+        kfree(rwlock);
+}
+
+/*
+ * Get the lock for reading. Wait while there is a writer holding the
+ * lock or waiting for it.
+ */
+void rwlock_acquire_read(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+        KASSERT(!curthread->t_in_interrupt);
+
+        spinlock_acquire(&rwlock->rw_lock);
+        KASSERT(rwlock->rw_writer != curthread);
+        while (rwlock->rw_writer != NULL || rwlock->rw_writerswaiting > 0)
+        {
+                wchan_sleep(rwlock->rw_readwchan, &rwlock->rw_lock);
+        }
+        rwlock->rw_readers++;
+        spinlock_release(&rwlock->rw_lock);
+}
+
+/* Free the lock for reading. The last reader out lets a writer in. */
+void rwlock_release_read(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+
+        spinlock_acquire(&rwlock->rw_lock);
+        KASSERT(rwlock->rw_readers > 0);
+        KASSERT(rwlock->rw_writer == NULL);
+        rwlock->rw_readers--;
+        if (rwlock->rw_readers == 0 && rwlock->rw_writerswaiting > 0)
+        {
+                wchan_wakeone(rwlock->rw_writewchan, &rwlock->rw_lock);
+        }
+        spinlock_release(&rwlock->rw_lock);
+}
+
+/* Get the lock for writing. Wait until there are no readers or writer. */
+void rwlock_acquire_write(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+        KASSERT(!curthread->t_in_interrupt);
+
+        spinlock_acquire(&rwlock->rw_lock);
+        KASSERT(rwlock->rw_writer != curthread);
+        /* counting ourselves as waiting holds off new readers */
+        rwlock->rw_writerswaiting++;
+        while (rwlock->rw_writer != NULL || rwlock->rw_readers > 0)
+        {
+                wchan_sleep(rwlock->rw_writewchan, &rwlock->rw_lock);
+        }
+        rwlock->rw_writerswaiting--;
+        rwlock->rw_writer = curthread;
+        spinlock_release(&rwlock->rw_lock);
+}
+
+/*
+ * Free the lock for writing. Hand it to the next writer if there is
+ * one; otherwise let all the waiting readers in.
+ */
+void rwlock_release_write(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+
+        spinlock_acquire(&rwlock->rw_lock);
+        KASSERT(rwlock->rw_writer == curthread);
+        rwlock->rw_writer = NULL;
+        if (rwlock->rw_writerswaiting > 0)
+        {
+                wchan_wakeone(rwlock->rw_writewchan, &rwlock->rw_lock);
+        }
+        else
+        {
+                wchan_wakeall(rwlock->rw_readwchan, &rwlock->rw_lock);
+        }
+        spinlock_release(&rwlock->rw_lock);
+}
@@ -40,6 +40,7 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <clock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
@@ -47,6 +48,7 @@
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
+#include <kmem.h>
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
@@ -57,6 +59,21 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Scheduler tuning. A thread at priority level N may run for
+ * sched_quantum[N] hardclocks before it drops a level; a ready thread
+ * that has waited SCHED_AGE_HARDCLOCKS without running goes up one.
+ */
+static const unsigned sched_quantum[SCHED_NPRIO] = {1, 2, 4, 8};
+#define SCHED_AGE_HARDCLOCKS (HZ / 2)
+
+/*
+ * A thread that stopped running less than SCHED_HOT_HARDCLOCKS ago
+ * probably still has its working set in its cpu's cache, so an idle
+ * cpu looking for work leaves it where it is.
+ */
+#define SCHED_HOT_HARDCLOCKS 2
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan
 {
@@ -117,9 +134,39 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Thread structures come from an object cache. A thread structure
+ * that has had a stack keeps it while it sits in the cache, so most
+ * forks don't have to allocate one.
+ */
+static struct kmem_cache *thread_cache;
+
+static int
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	thread->t_stack = NULL;
+	return 0;
+}
+
+static void
+thread_dtor(void *obj)
+{
+	struct thread *thread = obj;
+
+	if (thread->t_stack != NULL)
+	{
+		kfree(thread->t_stack);
+	}
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
+ *
+ * The new thread may already have a stack (t_stack) left over from
+ * a previous use of the structure.
  */
 static struct thread *
 thread_create(const char *name)
@@ -128,7 +175,7 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(thread_cache);
 	if (thread == NULL)
 	{
 		return NULL;
@@ -137,7 +184,7 @@ thread_create(const char *name)
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL)
 	{
-		kfree(thread);
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -146,10 +193,19 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_readysince = 0;
+	thread->t_lastran = 0;
+	thread->t_rqcpu = NULL;
+	thread->t_rqlevel = 0;
+	thread->t_inherit = SCHED_NPRIO;
+	thread->t_pilocks = NULL;
+	thread->t_waitlock = NULL;
+	thread->t_waitprio = 0;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -174,6 +230,7 @@ cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
 	int result;
+	unsigned i;
 	char namebuf[16];
 
 	c = kmalloc(sizeof(*c));
@@ -189,13 +246,19 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_kmalloc = NULL;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	for (i = 0; i < SCHED_NPRIO; i++)
+	{
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
+	spinlock_init_ticket(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_gen = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -204,6 +267,10 @@ cpu_create(unsigned hardware_number)
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
 
+	snprintf(namebuf, sizeof(namebuf), "cpu%u runqueue", c->c_number);
+	spinlock_stats_attach(&c->c_runqueue_lock, &c->c_runqueue_stats,
+			      namebuf);
+
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
 	if (c->c_curthread == NULL)
@@ -224,19 +291,27 @@ cpu_create(unsigned hardware_number)
 		 * can't be freed. (Exercise: what would it take to
 		 * make it possible to free the boot stack?)
 		 */
-		/*c->c_curthread->t_stack = ... */
+		if (c->c_curthread->t_stack != NULL)
+		{
+			kfree(c->c_curthread->t_stack);
+			c->c_curthread->t_stack = NULL;
+		}
 	}
 	else
 	{
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
 		if (c->c_curthread->t_stack == NULL)
 		{
-			panic("cpu_create: couldn't allocate stack");
+			c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+			if (c->c_curthread->t_stack == NULL)
+			{
+				panic("cpu_create: couldn't allocate stack");
+			}
 		}
 		thread_checkstack_init(c->c_curthread);
 	}
 	c->c_curthread->t_cpu = c;
 
+	kmalloc_cpuinit(c);
 	cpu_machdep_init(c);
 
 	return c;
@@ -263,18 +338,17 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL)
-	{
-		kfree(thread->t_stack);
-	}
+	KASSERT(thread->t_pilocks == NULL);
+	KASSERT(thread->t_waitlock == NULL);
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
+	/* The stack, if any, stays with the structure for reuse. */
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
 }
 
 /*
@@ -303,6 +377,9 @@ exorcise(void)
  */
 void thread_panic(void)
 {
+	struct threadlist *rq;
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -317,9 +394,14 @@ void thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i = 0; i < SCHED_NPRIO; i++)
+	{
+		rq = &curcpu->c_runqueue[i];
+		rq->tl_count = 0;
+		rq->tl_head.tln_next = &rq->tl_tail;
+		rq->tl_tail.tln_prev = &rq->tl_head;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -363,6 +445,13 @@ void thread_bootstrap(void)
 
 	cpuarray_init(&allcpus);
 
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 thread_ctor, thread_dtor);
+	if (thread_cache == NULL)
+	{
+		panic("thread_bootstrap: Out of memory\n");
+	}
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -446,6 +535,218 @@ void thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * The priority T is scheduled at: its own, or a better one it has
+ * inherited through a lock (see synch.c).
+ */
+static unsigned
+thread_prio(struct thread *t)
+{
+	return t->t_inherit < t->t_priority ? t->t_inherit : t->t_priority;
+}
+
+/*
+ * Run queue operations. Each cpu has one run queue per priority
+ * level, highest (0) first; c_runcount is the total across all of
+ * them. The caller must hold the cpu's run queue lock.
+ */
+
+/* Put T on the tail of the run queue for its priority. */
+static void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_priority < SCHED_NPRIO);
+
+	t->t_readysince = c->c_hardclocks;
+	t->t_rqcpu = c;
+	t->t_rqlevel = thread_prio(t);
+	threadlist_addtail(&c->c_runqueue[t->t_rqlevel], t);
+	c->c_runcount++;
+}
+
+/* Take the next thread to run: the head of the highest nonempty queue. */
+static struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i = 0; i < SCHED_NPRIO; i++)
+	{
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL)
+		{
+			c->c_runcount--;
+			t->t_rqcpu = NULL;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Take the thread least due to run: the tail of the lowest nonempty queue. */
+static struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i = SCHED_NPRIO; i-- > 0;)
+	{
+		t = threadlist_remtail(&c->c_runqueue[i]);
+		if (t != NULL)
+		{
+			c->c_runcount--;
+			t->t_rqcpu = NULL;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Return true if a thread of priority PRIO or better is waiting. */
+static bool
+runqueue_hasready(struct cpu *c, unsigned prio)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i = 0; i <= prio && i < SCHED_NPRIO; i++)
+	{
+		if (!threadlist_isempty(&c->c_runqueue[i]))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Return true if thread T, on cpu C's run queue, may be stolen: it is
+ * not C's c_curthread (see thread_consider_migration) and is no longer
+ * cache-hot.
+ */
+static bool
+runqueue_canshare(struct cpu *c, struct thread *t)
+{
+	return t != c->c_curthread &&
+		c->c_hardclocks - t->t_lastran >= SCHED_HOT_HARDCLOCKS;
+}
+
+/*
+ * Find a thread another cpu can take: search from the tail of the
+ * lowest-priority queue up, skipping threads runqueue_canshare says
+ * to leave alone. Returns the thread, removed from the run queue, or
+ * NULL.
+ */
+static struct thread *
+runqueue_remsteal(struct cpu *c)
+{
+	struct threadlistnode *tln;
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i = SCHED_NPRIO; i-- > 0;)
+	{
+		tln = c->c_runqueue[i].tl_tail.tln_prev;
+		for (; tln->tln_self != NULL; tln = tln->tln_prev)
+		{
+			t = tln->tln_self;
+			if (!runqueue_canshare(c, t))
+			{
+				continue;
+			}
+			threadlist_remove(&c->c_runqueue[i], t);
+			c->c_runcount--;
+			t->t_rqcpu = NULL;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Work stealing. Called by an idle cpu, with no run queue locks held,
+ * to take a ready thread off the busiest other cpu. Returns the thread,
+ * which now belongs to this cpu, or NULL if there is nothing suitable.
+ *
+ * The counts are read without locks to choose a victim; we only lock
+ * the one cpu we actually steal from, so there is no lock ordering
+ * problem with other cpus doing the same.
+ */
+static struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, most;
+
+	victim = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i = 0; i < numcpus; i++)
+	{
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self && c->c_runcount > most)
+		{
+			victim = c;
+			most = c->c_runcount;
+		}
+	}
+	if (victim == NULL)
+	{
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = runqueue_remsteal(victim);
+	if (t != NULL)
+	{
+		t->t_cpu = curcpu->c_self;
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (t != NULL)
+	{
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+			  t->t_name, victim->c_number, curcpu->c_number);
+	}
+	return t;
+}
+
+/*
+ * Send an idle cpu other than BUSY, if there is one, off to look for
+ * work. Idle cpus don't poll, as their clocks are stopped, so this is
+ * how they find out there is something to steal. c_isidle is read
+ * without the run queue lock; if it's stale we just miss a chance or
+ * wake a cpu for nothing.
+ */
+static void
+thread_unidle_one(struct cpu *busy)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i = 0; i < numcpus; i++)
+	{
+		c = cpuarray_get(&allcpus, i);
+		if (c != busy && c->c_isidle)
+		{
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
 /*
  * Make a thread runnable.
  *
@@ -471,7 +772,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle)
 	{
@@ -481,6 +782,15 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (target != curthread && runqueue_canshare(targetcpu, target))
+	{
+		/*
+		 * It will have to wait; maybe someone else can take it.
+		 * If it's still cache-hot nobody would, so don't wake a
+		 * cpu just to find that out.
+		 */
+		thread_unidle_one(targetcpu);
+	}
 
 	if (!already_have_lock)
 	{
@@ -512,12 +822,15 @@ int thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	/* Allocate a stack, unless the structure came with one */
 	if (newthread->t_stack == NULL)
 	{
-		thread_destroy(newthread);
-		return ENOMEM;
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL)
+		{
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
 	}
 	thread_checkstack_init(newthread);
 
@@ -596,9 +909,14 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
+	cur->t_lastran = curcpu->c_hardclocks;
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue))
+	/*
+	 * Micro-optimization: if nothing to do, just return. Yielding
+	 * only gives way to threads of the same or better priority.
+	 */
+	if (newstate == S_READY &&
+		!runqueue_hasready(curcpu->c_self, thread_prio(cur)))
 	{
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
@@ -634,10 +952,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call md_idle().
+	 * Get the next thread. While there isn't one, try to steal one
+	 * from another cpu, and failing that call md_idle().
 	 * curcpu->c_isidle must be true when md_idle is
-	 * called. Unlock the runqueue while idling too, to make sure
-	 * things can be added to it.
+	 * called. Unlock the runqueue while stealing and idling too, to
+	 * make sure things can be added to it.
 	 *
 	 * Note that we don't need to unlock the runqueue atomically
 	 * with idling; becoming unidle requires receiving an
@@ -654,11 +973,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	curcpu->c_isidle = true;
 	do
 	{
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu->c_self);
 		if (next == NULL)
 		{
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			next = thread_steal();
+			if (next == NULL)
+			{
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -859,16 +1182,163 @@ void thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * The run queues form a multi-level feedback queue. New threads start
+ * at the top level. A thread that runs for a whole quantum drops a
+ * level (thread_tick), and one that goes to sleep gets a level back
+ * when woken (wchan_wakeone/wakeall), so CPU-bound threads sink
+ * while those that mostly wait for I/O or each other stay near the
+ * top. Within a level threads run round-robin, and the quantum grows
+ * as the level drops.
+ *
+ * Charge the current thread for a hardclock. When its quantum runs
+ * out it is demoted and yields; it is also preempted as soon as a
+ * thread of higher priority is waiting.
+ */
+void thread_tick(void)
+{
+	struct thread *cur;
+	bool yield;
+
+	cur = curthread;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (curcpu->c_isidle)
+	{
+		/* Nobody to charge; the idle loop takes care of itself. */
+		spinlock_release(&curcpu->c_runqueue_lock);
+		return;
+	}
+	cur->t_ticks++;
+	if (cur->t_ticks >= sched_quantum[cur->t_priority])
+	{
+		cur->t_ticks = 0;
+		if (cur->t_priority < SCHED_NPRIO - 1)
+		{
+			cur->t_priority++;
+		}
+		yield = true;
+	}
+	else
+	{
+		yield = thread_prio(cur) > 0 &&
+				runqueue_hasready(curcpu->c_self, thread_prio(cur) - 1);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (yield)
+	{
+		thread_yield();
+	}
+}
+
+/*
+ * A thread waking up from wchan_sleep gets back a priority level and
+ * a fresh quantum. The thread is on no run queue yet, so the caller's
+ * wchan lock is all the protection needed.
+ */
+static void
+thread_wakeboost(struct thread *t)
+{
+	if (t->t_priority > 0)
+	{
+		t->t_priority--;
+	}
+	t->t_ticks = 0;
+}
+
+/*
+ * Return the priority T is scheduled at, including any it inherits.
+ */
+unsigned
+thread_getpriority(struct thread *t)
+{
+	return thread_prio(t);
+}
+
+/*
+ * Set the priority T inherits through locks. If T is waiting on a run
+ * queue, move it to the queue for its new priority, so that it gets to
+ * run (and let go of the lock) ahead of the threads it was behind.
+ * It keeps its t_readysince, so the time it has already spent waiting
+ * still counts towards aging (see schedule).
+ *
+ * A thread can move between cpus while we look for it, so go around
+ * until we hold the lock of the cpu it is queued on. If it is on no
+ * run queue, the new priority takes effect when it is next queued.
  */
+void
+thread_inherit(struct thread *t, unsigned prio)
+{
+	struct cpu *c;
+	unsigned readysince;
+
+	KASSERT(prio <= SCHED_NPRIO);
+
+	while ((c = t->t_rqcpu) != NULL)
+	{
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (t->t_rqcpu == c)
+		{
+			threadlist_remove(&c->c_runqueue[t->t_rqlevel], t);
+			c->c_runcount--;
+			t->t_inherit = prio;
+			readysince = t->t_readysince;
+			runqueue_add(c, t);
+			t->t_readysince = readysince;
+			spinlock_release(&c->c_runqueue_lock);
+			return;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+	t->t_inherit = prio;
+}
 
+/*
+ * This is called periodically from hardclock(). It ages the current
+ * CPU's run queues: a thread that has been ready for
+ * SCHED_AGE_HARDCLOCKS without getting to run moves up a queue, and
+ * its own priority goes up a level, so a steady supply of interactive
+ * threads cannot starve the rest.
+ *
+ * The queue a thread is on may reflect a priority it has inherited
+ * (see thread_inherit), so the new priority comes from t_priority and
+ * not from the queue; otherwise the boost would outlive the lock.
+ * thread_inherit requeues threads without resetting t_readysince, so
+ * a queue is not necessarily in t_readysince order and we go through
+ * all of it, keeping the order of the threads that stay.
+ */
 void schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct cpu *c;
+	struct thread *t;
+	unsigned i, n, now;
+
+	c = curcpu->c_self;
+
+	spinlock_acquire(&c->c_runqueue_lock);
+	now = c->c_hardclocks;
+	for (i = 1; i < SCHED_NPRIO; i++)
+	{
+		for (n = c->c_runqueue[i].tl_count; n > 0; n--)
+		{
+			t = threadlist_remhead(&c->c_runqueue[i]);
+			KASSERT(t != NULL);
+			if (now - t->t_readysince < SCHED_AGE_HARDCLOCKS)
+			{
+				threadlist_addtail(&c->c_runqueue[i], t);
+				continue;
+			}
+			if (t->t_priority > 0)
+			{
+				t->t_priority--;
+			}
+			t->t_ticks = 0;
+			t->t_readysince = now;
+			t->t_rqlevel = i - 1;
+			threadlist_addtail(&c->c_runqueue[i - 1], t);
+		}
+	}
+	spinlock_release(&c->c_runqueue_lock);
 }
 
 /*
@@ -876,7 +1346,9 @@ void schedule(void)
  *
  * This is also called periodically from hardclock(). If the current
  * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * threads across to those other other CPUs. (A CPU that runs out of
+ * work does not wait for this; it steals from the busiest CPU in the
+ * idle loop of thread_switch.)
  *
  * Migrating threads isn't free because of cache affinity; a thread's
  * working cache set will end up having to be moved to the other CPU,
@@ -902,10 +1374,10 @@ void thread_consider_migration(void)
 	{
 		c = cpuarray_get(&allcpus, i);
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += c->c_runcount;
 		if (c == curcpu->c_self)
 		{
-			my_count = c->c_runqueue.tl_count;
+			my_count = c->c_runcount;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
@@ -921,7 +1393,8 @@ void thread_consider_migration(void)
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i = 0; i < to_send; i++)
 	{
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		/* Send the lowest-priority threads; they have least to lose. */
+		t = runqueue_remtail(curcpu->c_self);
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -934,7 +1407,7 @@ void thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0)
+		while (c->c_runcount < one_share && to_send > 0)
 		{
 			t = threadlist_remhead(&victims);
 			/*
@@ -967,7 +1440,7 @@ void thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 				  "Migrated thread %s: cpu %u -> %u",
 				  t->t_name, curcpu->c_number, c->c_number);
@@ -994,7 +1467,7 @@ void thread_consider_migration(void)
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL)
 		{
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu->c_self, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1073,6 +1546,15 @@ void wchan_destroy(struct wchan *wc)
 	kfree(wc);
 }
 
+/*
+ * Rename a wait channel. Must be empty.
+ */
+void wchan_setname(struct wchan *wc, const char *name)
+{
+	KASSERT(threadlist_isempty(&wc->wc_threads));
+	wc->wc_name = name;
+}
+
 /*
  * Yield the cpu to another process, and go to sleep, on the specified
  * wait channel WC, whose associated spinlock is LK. Calling wakeup on
@@ -1121,6 +1603,7 @@ void wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 * in thread_switch.
 	 */
 
+	thread_wakeboost(target);
 	thread_make_runnable(target, false);
 }
 
@@ -1152,6 +1635,7 @@ void wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL)
 	{
+		thread_wakeboost(target);
 		thread_make_runnable(target, false);
 	}
 
@@ -1206,27 +1690,119 @@ void ipi_broadcast(int code)
 	}
 }
 
-void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+/*
+ * Queue NUM shootdowns on TARGET, or a full flush if NUM is more than
+ * TLBSHOOTDOWN_MAX, send one IPI for all of them, and return the
+ * shootdown generation that has to go by before they are known to be
+ * done.
+ */
+static unsigned ipi_tlbshootdown_gen(struct cpu *target,
+				     const struct tlbshootdown *mappings,
+				     unsigned num)
 {
+	unsigned gen, i;
 	int n;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX)
+	if (n == TLBSHOOTDOWN_ALL || num > (unsigned)(TLBSHOOTDOWN_MAX - n))
 	{
+		/* Too many to be worth doing one at a time. */
 		target->c_numshootdown = TLBSHOOTDOWN_ALL;
 	}
 	else
 	{
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n + 1;
+		for (i = 0; i < num; i++)
+		{
+			target->c_shootdown[n++] = mappings[i];
+		}
+		target->c_numshootdown = n;
 	}
+	gen = target->c_shootdown_gen;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
+	return gen;
+}
+
+void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	(void)ipi_tlbshootdown_gen(target, mapping, 1);
+}
+
+/*
+ * Number of cpus ipi_tlbshootdown_wait keeps in flight at once; just
+ * bounds the size of its generation array.
+ */
+#define SHOOTDOWN_BATCH 32
+
+void ipi_tlbshootdown_wait(const struct tlbshootdown *mappings, unsigned num)
+{
+	unsigned gens[SHOOTDOWN_BATCH];
+	unsigned base, i, numcpus, batch;
+	struct cpu *c;
+	int spl;
+
+	KASSERT(curcpu->c_spinlocks == 0);
+
+	/*
+	 * Do our own cpu directly. Interrupts are off so we can't be
+	 * migrated to another cpu partway through.
+	 */
+	spl = splhigh();
+	if (num > TLBSHOOTDOWN_MAX)
+	{
+		vm_tlbshootdown_all();
+	}
+	else
+	{
+		for (i = 0; i < num; i++)
+		{
+			vm_tlbshootdown(&mappings[i]);
+		}
+	}
+	c = curcpu->c_self;
+	splx(spl);
+
+	/*
+	 * Send to a batch of cpus, then wait for the batch, so the
+	 * other cpus do their part in parallel. If we have moved since
+	 * doing the local flush, the cpu we are on now gets an IPI like
+	 * everyone else and answers it when interrupts allow, since
+	 * they are on while we wait.
+	 */
+	numcpus = cpuarray_num(&allcpus);
+	for (base = 0; base < numcpus; base += batch)
+	{
+		batch = numcpus - base;
+		if (batch > SHOOTDOWN_BATCH)
+		{
+			batch = SHOOTDOWN_BATCH;
+		}
+		for (i = 0; i < batch; i++)
+		{
+			if (cpuarray_get(&allcpus, base + i) != c)
+			{
+				gens[i] = ipi_tlbshootdown_gen(
+					cpuarray_get(&allcpus, base + i),
+					mappings, num);
+			}
+		}
+		for (i = 0; i < batch; i++)
+		{
+			if (cpuarray_get(&allcpus, base + i) != c)
+			{
+				while (cpuarray_get(&allcpus, base + i)
+				       ->c_shootdown_gen == gens[i])
+				{
+					/* spin */
+				}
+			}
+		}
+	}
 }
 
 void interprocessor_interrupt(void)
@@ -1278,6 +1854,7 @@ void interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_gen++;
 	}
 
 	curcpu->c_ipi_pending = 0;
@@ -30,13 +30,23 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <proc.h>
+#include <synch.h>
 #include <addrspace.h>
+#include <pagetable.h>
+#include <pagecache.h>
+#include <vnode.h>
 #include <vm.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
  * assignment, this file is not compiled or linked or in any way
  * used. The cheesy hack versions in dumbvm.c are used instead.
+ *
+ * An address space is a list of regions plus a two-level page table.
+ * Nothing is allocated for a page until it is first touched, and
+ * as_copy shares pages copy-on-write instead of duplicating them; see
+ * vm_fault().
  */
 
 struct addrspace *
@@ -49,28 +59,196 @@ as_create(void)
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_regions = NULL;
+	as->as_loading = false;
+	as->as_heap = NULL;
+	as->as_heapend = 0;
+
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		pt_destroy(as->as_pt, as);
+		kfree(as);
+		return NULL;
+	}
 
 	return as;
 }
 
+/*
+ * Add a region to the front of the list.
+ */
+static
+int
+as_addregion(struct addrspace *as, vaddr_t base, size_t npages, int perms)
+{
+	struct region *rg;
+
+	rg = kmalloc(sizeof(struct region));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_base = base;
+	rg->rg_npages = npages;
+	rg->rg_perms = perms;
+	rg->rg_mapflags = 0;
+	rg->rg_vnode = NULL;
+	rg->rg_offset = 0;
+	rg->rg_next = as->as_regions;
+	as->as_regions = rg;
+	return 0;
+}
+
+/*
+ * Return a nonempty region overlapping the NPAGES pages at BASE, or
+ * NULL if there is none.
+ */
+static
+struct region *
+as_overlap(struct addrspace *as, vaddr_t base, size_t npages)
+{
+	struct region *rg;
+	vaddr_t top;
+
+	top = base + npages * PAGE_SIZE;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_npages > 0 && base < rg->rg_base +
+		    rg->rg_npages * PAGE_SIZE && rg->rg_base < top) {
+			return rg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Release the pages of a mapped-file region. Every page that has a
+ * page table entry was counted by the page cache when it was filled
+ * (or copied by fork), so uncount it, telling the cache whether this
+ * mapping wrote to it.
+ */
+static
+void
+as_unmapfile(struct addrspace *as, struct region *rg)
+{
+	size_t i;
+	vaddr_t va;
+	pte_t *pte;
+	bool dirty;
+
+	KASSERT(rg->rg_vnode != NULL);
+
+	for (i = 0; i < rg->rg_npages; i++) {
+		va = rg->rg_base + i * PAGE_SIZE;
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL || *pte == 0) {
+			continue;
+		}
+		/* Only our own faults set it, and shared pages stay put. */
+		dirty = (*pte & PTE_DIRTY) != 0;
+		pt_unmap(as->as_pt, as, va, va + PAGE_SIZE);
+		pagecache_put(rg->rg_vnode, rg->rg_offset + i * PAGE_SIZE,
+			      dirty);
+	}
+}
+
+/*
+ * Count the pages NEWAS got from a mapped-file region of its parent
+ * in the page cache.
+ */
+static
+void
+as_copyfile(struct addrspace *newas, struct region *rg)
+{
+	size_t i;
+	pte_t *pte;
+
+	for (i = 0; i < rg->rg_npages; i++) {
+		pte = pt_lookup(newas->as_pt, rg->rg_base + i * PAGE_SIZE,
+				false);
+		if (pte != NULL && *pte != 0) {
+			pagecache_ref(rg->rg_vnode,
+				      rg->rg_offset + i * PAGE_SIZE);
+		}
+	}
+}
+
+/*
+ * Free a region that has already been unlinked, and any file pages
+ * it has.
+ */
+static
+void
+as_freeregion(struct addrspace *as, struct region *rg)
+{
+	if (rg->rg_vnode != NULL) {
+		as_unmapfile(as, rg);
+		VOP_DECREF(rg->rg_vnode);
+	}
+	kfree(rg);
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct region *rg;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
+	lock_acquire(old->as_lock);
+
+	for (rg = old->as_regions; rg != NULL; rg = rg->rg_next) {
+		result = as_addregion(newas, rg->rg_base, rg->rg_npages,
+				      rg->rg_perms);
+		if (result) {
+			lock_release(old->as_lock);
+			as_destroy(newas);
+			return result;
+		}
+		if (rg == old->as_heap) {
+			newas->as_heap = newas->as_regions;
+		}
+		newas->as_regions->rg_mapflags = rg->rg_mapflags;
+		newas->as_regions->rg_offset = rg->rg_offset;
+		if (rg->rg_vnode != NULL) {
+			VOP_INCREF(rg->rg_vnode);
+			newas->as_regions->rg_vnode = rg->rg_vnode;
+		}
+	}
+	newas->as_heapend = old->as_heapend;
+
 	/*
-	 * Write this.
+	 * Share the pages rather than copying them. The parent's TLB
+	 * may still hold writable entries for them; it is running on
+	 * this CPU (processes are single-threaded), and as_activate
+	 * flushes the TLB everywhere else it could run, so a local
+	 * flush is enough.
 	 */
+	result = pt_copy(old->as_pt, newas->as_pt, newas);
+	if (old == proc_getas()) {
+		vm_tlbflush();
+	}
 
-	(void)old;
+	/* Even if that failed partway, as_destroy will uncount these. */
+	for (rg = newas->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_vnode != NULL) {
+			as_copyfile(newas, rg);
+		}
+	}
+	lock_release(old->as_lock);
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
 
 	*ret = newas;
 	return 0;
@@ -79,10 +257,14 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	struct region *rg;
 
+	while ((rg = as->as_regions) != NULL) {
+		as->as_regions = rg->rg_next;
+		as_freeregion(as, rg);
+	}
+	pt_destroy(as->as_pt, as);
+	lock_destroy(as->as_lock);
 	kfree(as);
 }
 
@@ -91,7 +273,7 @@ as_activate(void)
 {
 	struct addrspace *as;
 
-	as = curproc_getas();
+	as = proc_getas();
 	if (as == NULL) {
 		/*
 		 * Kernel thread without an address space; leave the
@@ -100,18 +282,16 @@ as_activate(void)
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
+	/* We don't use ASIDs, so everything in the TLB has to go. */
+	vm_tlbflush();
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * Nothing to do; as_activate flushes the TLB when the next
+	 * address space comes in.
 	 */
 }
 
@@ -121,57 +301,78 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. Only
+ * write permission is enforced, since the MIPS MMU cannot tell reads
+ * from instruction fetches.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	size_t npages;
+	int perms;
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+	npages = sz / PAGE_SIZE;
+
+	if (vaddr + sz > USERSPACETOP || vaddr + sz < vaddr) {
+		return EFAULT;
+	}
+
+	perms = (readable ? RG_READ : 0) | (writeable ? RG_WRITE : 0) |
+		(executable ? RG_EXEC : 0);
+
+	/* The heap goes after the last region the program defines. */
+	if (as->as_heap == NULL && vaddr + sz > as->as_heapend) {
+		as->as_heapend = vaddr + sz;
+	}
 
-	(void)as;
-	(void)vaddr;
-	(void)sz;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return EUNIMP;
+	return as_addregion(as, vaddr, npages, perms);
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
-
-	(void)as;
+	/* Let load_elf write into read-only segments. */
+	as->as_loading = true;
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
 
-	(void)as;
+	as->as_loading = false;
+
+	/* Start out with an empty heap after the program's segments. */
+	KASSERT(as->as_heap == NULL);
+	result = as_addregion(as, as->as_heapend, 0, RG_READ | RG_WRITE);
+	if (result) {
+		return result;
+	}
+	as->as_heap = as->as_regions;
+
+	/* Drop the writable TLB entries the loader left behind. */
+	vm_tlbflush();
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
 
-	(void)as;
+	result = as_addregion(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+			      VM_STACKPAGES, RG_READ | RG_WRITE);
+	if (result) {
+		return result;
+	}
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -179,3 +380,175 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+struct region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr >= rg->rg_base &&
+		    vaddr < rg->rg_base + rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+	return NULL;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct region *heap;
+	vaddr_t oldend, newend, oldtop, newtop;
+
+	lock_acquire(as->as_lock);
+
+	heap = as->as_heap;
+	if (heap == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	oldend = as->as_heapend;
+	newend = oldend + amount;
+	if (amount < 0) {
+		if (newend < heap->rg_base || newend > oldend) {
+			lock_release(as->as_lock);
+			return EINVAL;
+		}
+	}
+	else if (newend < oldend || newend > USERSPACETOP) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	oldtop = heap->rg_base + heap->rg_npages * PAGE_SIZE;
+	newtop = ROUNDUP(newend, PAGE_SIZE);
+	if (newtop > oldtop &&
+	    as_overlap(as, oldtop, (newtop - oldtop) / PAGE_SIZE) != NULL) {
+		/* Would run into a mapping or the stack. */
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	heap->rg_npages = (newtop - heap->rg_base) / PAGE_SIZE;
+	as->as_heapend = newend;
+
+	if (newtop < oldtop) {
+		/*
+		 * Shrinking. The pages are already outside the region,
+		 * so nothing can fault them back in; get them out of
+		 * the TLBs and give them back.
+		 */
+		vm_shootdown(newtop, (oldtop - newtop) / PAGE_SIZE);
+		pt_unmap(as->as_pt, as, newtop, oldtop);
+	}
+
+	lock_release(as->as_lock);
+
+	*oldbreak = oldend;
+	return 0;
+}
+
+int
+as_mmap(struct addrspace *as, size_t len, int perms, struct vnode *vn,
+	off_t offset, int mapflags, vaddr_t *ret)
+{
+	struct region *rg;
+	size_t npages;
+	vaddr_t top, bottom, base;
+	int result;
+
+	npages = DIVROUNDUP(len, PAGE_SIZE);
+	if (npages == 0 || npages > USERSPACETOP / PAGE_SIZE) {
+		return EINVAL;
+	}
+
+	lock_acquire(as->as_lock);
+
+	/*
+	 * Work down from the stack to the first gap big enough, but
+	 * stay above the heap.
+	 */
+	bottom = ROUNDUP(as->as_heapend, PAGE_SIZE);
+	top = USERSTACK;
+	for (;;) {
+		if (top < bottom + npages * PAGE_SIZE) {
+			lock_release(as->as_lock);
+			return ENOMEM;
+		}
+		base = top - npages * PAGE_SIZE;
+		rg = as_overlap(as, base, npages);
+		if (rg == NULL) {
+			break;
+		}
+		top = rg->rg_base;
+	}
+
+	result = as_addregion(as, base, npages, perms);
+	if (result) {
+		lock_release(as->as_lock);
+		return result;
+	}
+	rg = as->as_regions;
+	rg->rg_mapflags = mapflags;
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+		rg->rg_vnode = vn;
+		rg->rg_offset = offset;
+	}
+
+	lock_release(as->as_lock);
+
+	*ret = base;
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	struct region *rg, **rgp;
+	vaddr_t end, rgend;
+
+	if (addr % PAGE_SIZE != 0 || len == 0) {
+		return EINVAL;
+	}
+	end = addr + ROUNDUP(len, PAGE_SIZE);
+	if (end < addr || end > USERSPACETOP) {
+		return EINVAL;
+	}
+
+	lock_acquire(as->as_lock);
+
+	/* Check everything first so we don't unmap half of it. */
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		rgend = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+		if (rg->rg_npages == 0 || rgend <= addr || rg->rg_base >= end) {
+			continue;
+		}
+		if (rg->rg_mapflags == 0 || rg->rg_base < addr || rgend > end) {
+			lock_release(as->as_lock);
+			return EINVAL;
+		}
+	}
+
+	rgp = &as->as_regions;
+	while ((rg = *rgp) != NULL) {
+		if (rg->rg_mapflags == 0 || rg->rg_base < addr ||
+		    rg->rg_base >= end) {
+			rgp = &rg->rg_next;
+			continue;
+		}
+		*rgp = rg->rg_next;
+
+		/* Now nothing can fault it back in; drop the pages. */
+		vm_shootdown(rg->rg_base, rg->rg_npages);
+		if (rg->rg_vnode == NULL) {
+			pt_unmap(as->as_pt, as, rg->rg_base,
+				 rg->rg_base + rg->rg_npages * PAGE_SIZE);
+		}
+		as_freeregion(as, rg);
+	}
+
+	lock_release(as->as_lock);
+	return 0;
+}
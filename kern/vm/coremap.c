@@ -0,0 +1,492 @@
+/*
+ * Coremap: physical page allocator.
+ *
+ * Every physical page has a coremap entry recording whether it is
+ * free, who owns it, and, for the first page of an allocation, how
+ * many contiguous pages were handed out together, so a run can be
+ * returned knowing only its base address. The first page also carries
+ * a reference count so that user pages can be shared copy-on-write
+ * after fork.
+ *
+ * The coremap array itself lives at the bottom of the memory
+ * ram_getfirstfree() hands us; it and everything below it (the kernel
+ * image, the exception vectors, and pages stolen before the coremap
+ * existed) are marked CME_FIXED and never reused.
+ *
+ * When nothing is free, a user page is pushed out to swap. The victim
+ * is chosen with the clock algorithm. The MIPS TLB has no reference
+ * bits, so they are emulated: vm_fault sets cme_referenced whenever it
+ * loads a mapping, and the clock hand clears it and drops the mapping
+ * from this CPU's TLB, so a page only gets a second chance if it is
+ * faulted on again. Other CPUs lose their mappings at every context
+ * switch, since we have no ASIDs.
+ *
+ * A user page can only be evicted if exactly one address space maps
+ * it and we know which one (cme_owner). When a shared page's owner
+ * drops it, nobody is the owner until the next fault on the page from
+ * the address space still using it.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include "opt-dumbvm.h"
+#if !OPT_DUMBVM
+#include <pagetable.h>
+#include <swap.h>
+#endif
+
+/*
+ * Protects everything below, ram_stealmem() before bootstrap, and
+ * user page table entries.
+ */
+struct spinlock coremap_lock = SPINLOCK_TICKET_INITIALIZER;
+static struct spinlock_stats coremap_lock_stats;
+
+static struct coremap_entry *coremap;	/* NULL until bootstrapped */
+static unsigned cm_nframes;		/* Total number of frames */
+static unsigned cm_firstframe;		/* First frame we may hand out */
+static unsigned cm_nextframe;		/* Where to start single-page scans */
+static unsigned cm_used;		/* Frames not CME_FREE */
+static unsigned cm_clockhand;		/* Next eviction candidate */
+static struct wchan *cm_wchan;		/* For PTE_BUSY waiters */
+
+#define PADDR_TO_FRAME(pa)   ((pa) / PAGE_SIZE)
+#define FRAME_TO_PADDR(fr)   ((paddr_t)(fr) * PAGE_SIZE)
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t firstfree, lastpaddr;
+	size_t cmsize;
+	unsigned i;
+
+	KASSERT(coremap == NULL);
+
+	lastpaddr = ram_getsize();
+	firstfree = ram_getfirstfree();
+
+	cm_nframes = lastpaddr / PAGE_SIZE;
+	cmsize = ROUNDUP(cm_nframes * sizeof(struct coremap_entry), PAGE_SIZE);
+
+	/* Carve the coremap out of the bottom of free memory. */
+	KASSERT(firstfree + cmsize < lastpaddr);
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(firstfree);
+	cm_firstframe = PADDR_TO_FRAME(firstfree + cmsize);
+
+	for (i = 0; i < cm_nframes; i++) {
+		coremap[i].cme_owner = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_state = (i < cm_firstframe) ? CME_FIXED : CME_FREE;
+		coremap[i].cme_busy = false;
+		coremap[i].cme_referenced = false;
+	}
+
+	cm_nextframe = cm_firstframe;
+	cm_clockhand = cm_firstframe;
+	cm_used = cm_firstframe;
+
+	kprintf("coremap: %u frames, %u available\n",
+		cm_nframes, cm_nframes - cm_firstframe);
+
+	cm_wchan = wchan_create("coremap");
+	if (cm_wchan == NULL) {
+		panic("coremap: wchan_create failed\n");
+	}
+
+	spinlock_stats_attach(&coremap_lock, &coremap_lock_stats, "coremap");
+}
+
+/*
+ * Find a run of NPAGES free frames. Single pages are the common case,
+ * so those start from where the last one was found rather than
+ * rescanning the low (usually full) part of memory every time.
+ * Must be called with coremap_lock held.
+ */
+static
+int
+coremap_findrun(unsigned npages, unsigned *ret)
+{
+	unsigned i, start, run;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	if (npages == 1) {
+		i = cm_nextframe;
+		do {
+			if (coremap[i].cme_state == CME_FREE) {
+				*ret = i;
+				return 0;
+			}
+			i++;
+			if (i == cm_nframes) {
+				i = cm_firstframe;
+			}
+		} while (i != cm_nextframe);
+		return -1;
+	}
+
+	run = 0;
+	start = cm_firstframe;
+	for (i = cm_firstframe; i < cm_nframes; i++) {
+		if (coremap[i].cme_state != CME_FREE) {
+			run = 0;
+			start = i + 1;
+			continue;
+		}
+		run++;
+		if (run == npages) {
+			*ret = start;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+#if !OPT_DUMBVM
+
+/*
+ * Advance the clock hand to a page that can be evicted and has not
+ * been used since the hand last went by. Must be called with
+ * coremap_lock held.
+ */
+static
+int
+coremap_clock(unsigned *ret)
+{
+	struct coremap_entry *cme;
+	unsigned i, n;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	/* Two trips around clear every reference bit and try again. */
+	for (n = 0; n < 2 * (cm_nframes - cm_firstframe); n++) {
+		i = cm_clockhand++;
+		if (cm_clockhand == cm_nframes) {
+			cm_clockhand = cm_firstframe;
+		}
+
+		cme = &coremap[i];
+		if (cme->cme_state != CME_USER || cme->cme_busy ||
+		    cme->cme_npages != 1 || cme->cme_refcount != 1 ||
+		    cme->cme_owner == NULL) {
+			continue;
+		}
+		if (cme->cme_referenced) {
+			cme->cme_referenced = false;
+			vm_tlbinvalidate(cme->cme_vaddr);
+			continue;
+		}
+		*ret = i;
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Push a user page out to swap and return it to the caller, still
+ * marked in use. Called with coremap_lock held, which is dropped and
+ * retaken while the page is written out; the caller must not hold any
+ * other spinlocks.
+ */
+static
+int
+coremap_evict(unsigned *ret)
+{
+	struct coremap_entry *cme;
+	unsigned fr, slot;
+	pte_t *pte;
+	int result;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	if (coremap_clock(&fr)) {
+		return -1;
+	}
+	cme = &coremap[fr];
+
+	/*
+	 * The owner can't free its second-level tables while it still
+	 * has a page in them, so the entry is there, and it can't get
+	 * rid of the page while we hold coremap_lock.
+	 */
+	pte = pt_lookup(cme->cme_owner->as_pt, cme->cme_vaddr, false);
+	KASSERT(pte != NULL);
+	KASSERT((*pte & (PTE_PRESENT | PTE_BUSY)) == PTE_PRESENT);
+	KASSERT((*pte & PTE_FRAME) == FRAME_TO_PADDR(fr));
+
+	/* Nobody may use or change the page until we're done. */
+	cme->cme_busy = true;
+	*pte |= PTE_BUSY;
+	spinlock_release(&coremap_lock);
+
+	result = swap_alloc(&slot);
+	if (result) {
+		spinlock_acquire(&coremap_lock);
+		*pte &= ~PTE_BUSY;
+		cme->cme_busy = false;
+		wchan_wakeall(cm_wchan, &coremap_lock);
+		return -1;
+	}
+
+	/*
+	 * vm_fault loads the TLB with coremap_lock held, so anyone who
+	 * saw the page before we marked it has already loaded it and
+	 * this gets rid of it.
+	 */
+	vm_shootdown(cme->cme_vaddr, 1);
+
+	result = swap_out(slot, FRAME_TO_PADDR(fr));
+	if (result) {
+		panic("coremap: swap_out: %s\n", strerror(result));
+	}
+
+	spinlock_acquire(&coremap_lock);
+	*pte = PTE_MKSWAPPED(slot);
+	wchan_wakeall(cm_wchan, &coremap_lock);
+
+	cme->cme_busy = false;
+	cme->cme_owner = NULL;
+	cme->cme_vaddr = 0;
+	cme->cme_refcount = 0;
+	cme->cme_referenced = false;
+
+	*ret = fr;
+	return 0;
+}
+
+#endif /* !OPT_DUMBVM */
+
+/*
+ * Common code for coremap_getppages and coremap_getupage.
+ */
+static
+paddr_t
+coremap_alloc(unsigned long npages, uint8_t state, struct addrspace *owner,
+	      vaddr_t vaddr, bool busy)
+{
+	paddr_t pa;
+	unsigned base, i;
+#if !OPT_DUMBVM
+	bool canevict;
+#endif
+
+	KASSERT(npages > 0);
+
+	spinlock_acquire(&coremap_lock);
+
+	if (coremap == NULL) {
+		/* Too early; steal memory we can never give back. */
+		pa = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		return pa;
+	}
+
+	if (coremap_findrun(npages, &base)) {
+#if !OPT_DUMBVM
+		/* Eviction sleeps, so only try it where that's allowed. */
+		canevict = npages == 1 && !curthread->t_in_interrupt &&
+			curcpu->c_spinlocks == 1;
+		if (!canevict || coremap_evict(&base)) {
+			spinlock_release(&coremap_lock);
+			return 0;
+		}
+		/* The evicted page is already counted in cm_used. */
+#else
+		spinlock_release(&coremap_lock);
+		return 0;
+#endif
+	}
+	else {
+		cm_used += npages;
+		cm_nextframe = base + npages;
+		if (cm_nextframe >= cm_nframes) {
+			cm_nextframe = cm_firstframe;
+		}
+	}
+
+	for (i = base; i < base + npages; i++) {
+		coremap[i].cme_state = state;
+		coremap[i].cme_owner = owner;
+		coremap[i].cme_vaddr = vaddr;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_busy = busy;
+		coremap[i].cme_referenced = false;
+	}
+	coremap[base].cme_npages = npages;
+	coremap[base].cme_refcount = 1;
+
+	spinlock_release(&coremap_lock);
+	return FRAME_TO_PADDR(base);
+}
+
+paddr_t
+coremap_getppages(unsigned long npages, struct addrspace *owner)
+{
+	return coremap_alloc(npages, (owner == NULL) ? CME_KERNEL : CME_USER,
+			     owner, 0, false);
+}
+
+paddr_t
+coremap_getupage(struct addrspace *as, vaddr_t vaddr)
+{
+	return coremap_alloc(1, CME_USER, as, vaddr, true);
+}
+
+/*
+ * Drop a reference to the run starting at PADDR, and free it if that
+ * was the last one. If AS owned it and someone else still has it, it
+ * no longer has an owner. Must be called with coremap_lock held.
+ */
+static
+void
+coremap_release(paddr_t paddr, struct addrspace *as)
+{
+	unsigned base, npages, i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(paddr % PAGE_SIZE == 0);
+
+	base = PADDR_TO_FRAME(paddr);
+	if (coremap == NULL || base < cm_firstframe) {
+		/* Stolen before bootstrap; leak it as we always have. */
+		return;
+	}
+
+	KASSERT(base < cm_nframes);
+	npages = coremap[base].cme_npages;
+	if (npages == 0 || coremap[base].cme_state == CME_FREE) {
+		panic("coremap: free of 0x%x, not the start of a run\n",
+		      paddr);
+	}
+	KASSERT(base + npages <= cm_nframes);
+	KASSERT(!coremap[base].cme_busy);
+
+	KASSERT(coremap[base].cme_refcount > 0);
+	coremap[base].cme_refcount--;
+	if (coremap[base].cme_refcount > 0) {
+		/* Still mapped somewhere else. */
+		if (as != NULL && coremap[base].cme_owner == as) {
+			coremap[base].cme_owner = NULL;
+		}
+		return;
+	}
+
+	for (i = base; i < base + npages; i++) {
+		KASSERT(coremap[i].cme_state == CME_KERNEL ||
+			coremap[i].cme_state == CME_USER);
+		coremap[i].cme_state = CME_FREE;
+		coremap[i].cme_owner = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_referenced = false;
+	}
+	KASSERT(cm_used >= npages);
+	cm_used -= npages;
+}
+
+void
+coremap_freeppages(paddr_t paddr)
+{
+	spinlock_acquire(&coremap_lock);
+	coremap_release(paddr, NULL);
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_freeupage(paddr_t paddr, struct addrspace *as)
+{
+	coremap_release(paddr, as);
+}
+
+/*
+ * Look up the head frame of a single user page. Must be called with
+ * coremap_lock held.
+ */
+static
+unsigned
+coremap_userframe(paddr_t paddr)
+{
+	unsigned fr;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(coremap != NULL);
+	KASSERT(paddr % PAGE_SIZE == 0);
+
+	fr = PADDR_TO_FRAME(paddr);
+	KASSERT(fr >= cm_firstframe && fr < cm_nframes);
+	KASSERT(coremap[fr].cme_state == CME_USER);
+	KASSERT(coremap[fr].cme_npages == 1);
+	return fr;
+}
+
+void
+coremap_unbusy(paddr_t paddr)
+{
+	unsigned fr;
+
+	fr = coremap_userframe(paddr);
+	KASSERT(coremap[fr].cme_busy);
+	coremap[fr].cme_busy = false;
+}
+
+void
+coremap_share(paddr_t paddr)
+{
+	unsigned fr;
+
+	fr = coremap_userframe(paddr);
+	KASSERT(coremap[fr].cme_refcount > 0);
+	coremap[fr].cme_refcount++;
+}
+
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	unsigned fr;
+
+	fr = coremap_userframe(paddr);
+	return coremap[fr].cme_refcount;
+}
+
+void
+coremap_touch(paddr_t paddr, struct addrspace *as)
+{
+	unsigned fr;
+
+	fr = coremap_userframe(paddr);
+	coremap[fr].cme_referenced = true;
+	if (coremap[fr].cme_owner == NULL && coremap[fr].cme_refcount == 1) {
+		/* The last sharer left; it's ours now. */
+		coremap[fr].cme_owner = as;
+	}
+}
+
+void
+coremap_wait(void)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	wchan_sleep(cm_wchan, &coremap_lock);
+}
+
+unsigned
+coremap_used_bytes(void)
+{
+	unsigned used;
+
+	spinlock_acquire(&coremap_lock);
+	used = cm_used * PAGE_SIZE;
+	spinlock_release(&coremap_lock);
+
+	return used;
+}
@@ -29,7 +29,10 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
 
 /*
@@ -74,9 +77,12 @@ fill_deadbeef(void *vptr, size_t len)
 //    sizes, and large numbers of items of the new size are allocated.
 //
 //    The free counts and addresses of the pages are maintained in
-//    another list.  Maintaining this table is a nuisance, because it
-//    cannot recursively use the subpage allocator. (We could probably
-//    make that work, but it would be painful.)
+//    pagerefs, which are kept on a list per block size and can also be
+//    found directly from a page's address, so freeing a block doesn't
+//    have to search for its page. Maintaining the pagerefs is a
+//    nuisance, because it cannot recursively use the subpage
+//    allocator. (We could probably make that work, but it would be
+//    painful.)
 //
 
 ////////////////////////////////////////
@@ -145,7 +151,7 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
-	struct pageref *next_all;
+	struct pageref *prev_samesize;
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -160,13 +166,15 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the heap pages and their lists. Most kmallocs
+ * and kfrees don't get this far: they are satisfied from per-cpu
+ * magazines of free blocks (see below), which only go to the heap
+ * pages in batches. When the batches collide, a ticket lock keeps
+ * one cpu from starving the others.
  */
 
-static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static struct spinlock kmalloc_spinlock = SPINLOCK_TICKET_INITIALIZER;
+static struct spinlock_stats kmalloc_spinlock_stats;
 
 ////////////////////////////////////////
 
@@ -339,11 +347,26 @@ freepageref(struct pageref *p)
 ////////////////////////////////////////
 
 /*
- * Each pageref is on two linked lists: one list of pages of blocks of
- * that same size, and one of all blocks.
+ * Each pageref is on a doubly linked list of pages of blocks of that
+ * same size.
  */
 static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
+
+/*
+ * The pageref for each heap page, indexed by physical page number, or
+ * NULL if the page isn't one of ours. This is how kfree gets from a
+ * pointer to its page in constant time; since it is only changed when
+ * a page is added to or removed from the heap, and a block being freed
+ * pins its page, kfree can read it without the lock. Like the pageref
+ * pages, it is sized for System/161's 16M of RAM.
+ *
+ * (It can't live in the coremap, because the heap is in use long
+ * before the coremap exists.)
+ */
+#define KHEAP_MAXPAGES (16*1024*1024 / PAGE_SIZE)
+#define KHEAP_PAGENUM(va) (KVADDR_TO_PADDR(va) / PAGE_SIZE)
+
+static struct pageref *pagerefs_bypage[KHEAP_MAXPAGES];
 
 ////////////////////////////////////////
 
@@ -588,15 +611,20 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
+			KASSERT(pr->next_samesize == NULL ||
+				pr->next_samesize->prev_samesize == pr);
+			KASSERT(pagerefs_bypage[KHEAP_PAGENUM(PR_PAGEADDR(pr))]
+				== pr);
 			KASSERT(sc < TOTAL_PAGEREFS);
 			sc++;
 		}
 	}
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		checksubpage(pr);
-		KASSERT(ac < TOTAL_PAGEREFS);
-		ac++;
+	for (i=0; i<KHEAP_MAXPAGES; i++) {
+		if (pagerefs_bypage[i] != NULL) {
+			KASSERT(ac < TOTAL_PAGEREFS);
+			ac++;
+		}
 	}
 
 	KASSERT(sc==ac);
@@ -800,15 +828,17 @@ subpage_stats(struct pageref *pr)
 void
 kheap_printstats(void)
 {
-	struct pageref *pr;
+	unsigned i;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
 	kprintf("Subpage allocator status:\n");
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		subpage_stats(pr);
+	for (i=0; i<KHEAP_MAXPAGES; i++) {
+		if (pagerefs_bypage[i] != NULL) {
+			subpage_stats(pagerefs_bypage[i]);
+		}
 	}
 
 	spinlock_release(&kmalloc_spinlock);
@@ -817,30 +847,25 @@ kheap_printstats(void)
 ////////////////////////////////////////
 
 /*
- * Remove a pageref from both lists that it's on.
+ * Remove a pageref from the list that it's on.
  */
 static
 void
-remove_lists(struct pageref *pr, int blktype)
+remove_list(struct pageref *pr, int blktype)
 {
-	struct pageref **guy;
-
 	KASSERT(blktype>=0 && blktype<NSIZES);
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
+	if (pr->prev_samesize != NULL) {
+		KASSERT(pr->prev_samesize->next_samesize == pr);
+		pr->prev_samesize->next_samesize = pr->next_samesize;
 	}
-
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
-		}
+	else {
+		KASSERT(sizebases[blktype] == pr);
+		sizebases[blktype] = pr->next_samesize;
+	}
+	if (pr->next_samesize != NULL) {
+		KASSERT(pr->next_samesize->prev_samesize == pr);
+		pr->next_samesize->prev_samesize = pr->prev_samesize;
 	}
 }
 
@@ -867,108 +892,73 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Take a block off the freelist of PR, which must have one.
  */
 static
 void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+subpage_takeblock(struct pageref *pr)
 {
-	unsigned blktype;	// index into sizes[] that we're using
-	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
-	struct freelist *volatile fl;	// free list entry
+	struct freelist *fl;	// free list entry
 	void *retptr;		// our result
 
-	volatile int i;
-
-#ifdef GUARDS
-	size_t clientsz;
-#endif
-
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-	sz = sizes[blktype];
-
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
-
-		/* check for corruption */
-		KASSERT(PR_BLOCKTYPE(pr) == blktype);
-		checksubpage(pr);
-
-		if (pr->nfree > 0) {
-
-		doalloc: /* comes here after getting a whole fresh page */
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
 
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
 
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
-#endif
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+	return retptr;
+}
 
-			checksubpages();
+/*
+ * Get a fresh page and carve it into blocks of type BLKTYPE. Returns
+ * its pageref, or NULL if we're out of memory.
+ *
+ * We release the spinlock while calling alloc_kpages. This avoids
+ * deadlock if alloc_kpages needs to come back here. Note that this
+ * means things can change behind our back...
+ */
+static
+struct pageref *
+subpage_newpage(unsigned blktype)
+{
+	struct pageref *pr;	// pageref for the new page
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *volatile fl;	// free list entry
 
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
-		}
-	}
+	volatile int i;
 
-	/*
-	 * No page of the right size available.
-	 * Make a new one.
-	 *
-	 * We release the spinlock while calling alloc_kpages. This
-	 * avoids deadlock if alloc_kpages needs to come back here.
-	 * Note that this means things can change behind our back...
-	 */
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
 	spinlock_release(&kmalloc_spinlock);
 	prpage = alloc_kpages(1);
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 	KASSERT(prpage % PAGE_SIZE == 0);
+	KASSERT(KHEAP_PAGENUM(prpage) < KHEAP_MAXPAGES);
 #ifdef CHECKBEEF
 	/* deadbeef the whole page, as it probably starts zeroed */
 	fill_deadbeef((void *)prpage, PAGE_SIZE);
@@ -981,6 +971,7 @@ subpage_kmalloc(size_t sz
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 
@@ -1005,14 +996,369 @@ subpage_kmalloc(size_t sz
 	pr->freelist_offset = fla - prpage;
 	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
+	pr->prev_samesize = NULL;
 	pr->next_samesize = sizebases[blktype];
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr;
+	}
 	sizebases[blktype] = pr;
 
-	pr->next_all = allbase;
-	allbase = pr;
+	KASSERT(pagerefs_bypage[KHEAP_PAGENUM(prpage)] == NULL);
+	pagerefs_bypage[KHEAP_PAGENUM(prpage)] = pr;
+
+	return pr;
+}
+
+/*
+ * Take up to N free blocks of type BLKTYPE out of the heap pages,
+ * making a new page only if there are none at all. Returns how many
+ * we got; 0 means we're out of memory.
+ */
+static
+unsigned
+subpage_getblocks(unsigned blktype, void **blocks, unsigned n)
+{
+	struct pageref *pr;
+	unsigned got;
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	checksubpages();
+
+	got = 0;
+	while (got < n) {
+		for (pr = sizebases[blktype]; pr != NULL;
+		     pr = pr->next_samesize) {
+			/* check for corruption */
+			KASSERT(PR_BLOCKTYPE(pr) == blktype);
+			checksubpage(pr);
+
+			if (pr->nfree > 0) {
+				break;
+			}
+		}
+		if (pr == NULL) {
+			if (got > 0) {
+				/* Don't grow the heap just to fill up. */
+				break;
+			}
+			pr = subpage_newpage(blktype);
+			if (pr == NULL) {
+				break;
+			}
+		}
+		while (got < n && pr->nfree > 0) {
+			blocks[got++] = subpage_takeblock(pr);
+		}
+	}
+
+	checksubpages();
+
+	spinlock_release(&kmalloc_spinlock);
+	return got;
+}
+
+/*
+ * Find the pageref for the heap page containing PTRADDR, or NULL if
+ * it isn't one. Safe without the lock as long as PTRADDR is a block
+ * that is currently allocated.
+ */
+static
+struct pageref *
+subpage_findpage(vaddr_t ptraddr)
+{
+	unsigned pagenum;
+	struct pageref *pr;
+
+	pagenum = KHEAP_PAGENUM(ptraddr);
+	if (pagenum >= KHEAP_MAXPAGES) {
+		return NULL;
+	}
+	pr = pagerefs_bypage[pagenum];
+	if (pr != NULL) {
+		/* check for corruption */
+		KASSERT(PR_PAGEADDR(pr) == (ptraddr & PAGE_FRAME));
+		KASSERT(PR_BLOCKTYPE(pr) < NSIZES);
+	}
+	return pr;
+}
+
+/*
+ * Put the N blocks in BLOCKS back on their pages' freelists, and give
+ * back any pages that become entirely free.
+ */
+static
+void
+subpage_putblocks(void **blocks, unsigned n)
+{
+	struct pageref *pr;	// pageref for page we're freeing in
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+	int blktype;		// index into sizes[] that we're using
+	unsigned i;
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	checksubpages();
+
+	for (i=0; i<n; i++) {
+		fla = (vaddr_t)blocks[i];
+		pr = subpage_findpage(fla);
+		KASSERT(pr != NULL);
+		prpage = PR_PAGEADDR(pr);
+		blktype = PR_BLOCKTYPE(pr);
+		offset = fla - prpage;
+
+		fl = (struct freelist *)fla;
+		if (pr->freelist_offset == INVALID_OFFSET) {
+			fl->next = NULL;
+		} else {
+			fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+
+			/* this block should not already be on the free list! */
+#ifdef SLOW
+			{
+				struct freelist *fl2;
+
+				for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+					KASSERT(fl2 != fl);
+				}
+			}
+#else
+			/* check just the head */
+			KASSERT(fl != fl->next);
+#endif
+		}
+		pr->freelist_offset = offset;
+		pr->nfree++;
+
+		KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+		if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+			/* Whole page is free. */
+			remove_list(pr, blktype);
+			freepageref(pr);
+			pagerefs_bypage[KHEAP_PAGENUM(prpage)] = NULL;
+			/* Call free_kpages without kmalloc_spinlock. */
+			spinlock_release(&kmalloc_spinlock);
+			free_kpages(prpage);
+			spinlock_acquire(&kmalloc_spinlock);
+		}
+	}
+
+	checksubpages();
+
+	spinlock_release(&kmalloc_spinlock);
+}
+
+////////////////////////////////////////
+
+/*
+ * Per-cpu magazines.
+ *
+ * Each cpu keeps a small stack (a "magazine") of free blocks of each
+ * size. Most subpage kmallocs and kfrees just pop or push the local
+ * cpu's magazine with interrupts off, and never touch kmalloc_spinlock.
+ * An empty magazine is refilled with magbatch[] blocks at once from
+ * the heap pages; a full one gives half its blocks back. Blocks in a
+ * magazine count as allocated as far as the heap pages are concerned,
+ * so a page can't be released while any of its blocks are cached; the
+ * sizes here bound that to about 14K per cpu.
+ *
+ * Magazines hold bare blocks: guard bands and labels are put on when
+ * a block is handed out, and it is deadbeefed when it comes back.
+ */
+
+#define MAG_MAXROUNDS 16
+
+/* Blocks moved to or from the heap pages at once, per size. */
+static const unsigned magbatch[NSIZES] = { 8, 8, 8, 8, 4, 2, 1, 1 };
+
+struct kmagazine {
+	unsigned km_nrounds;
+	void *km_rounds[MAG_MAXROUNDS];
+};
+
+struct kmalloc_cpu {
+	struct kmagazine kc_mags[NSIZES];
+};
+
+/*
+ * Set up the magazines for a new cpu. Until this is done the cpu
+ * allocates straight from the heap pages.
+ */
+void
+kmalloc_cpuinit(struct cpu *c)
+{
+	struct kmalloc_cpu *kc;
+	unsigned i;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		panic("kmalloc_cpuinit: Out of memory\n");
+	}
+	for (i=0; i<NSIZES; i++) {
+		KASSERT(2 * magbatch[i] <= MAG_MAXROUNDS);
+		kc->kc_mags[i].km_nrounds = 0;
+	}
+	c->c_kmalloc = kc;
+
+	if (c->c_number == 0) {
+		spinlock_stats_attach(&kmalloc_spinlock,
+				      &kmalloc_spinlock_stats, "kmalloc");
+	}
+}
+
+/*
+ * Get this cpu's magazine for BLKTYPE, or NULL if it doesn't have
+ * them yet. Must be called with interrupts off so we stay on this cpu
+ * and nothing else on it uses the magazine at the same time.
+ */
+static
+struct kmagazine *
+kmag_get(unsigned blktype)
+{
+	if (!CURCPU_EXISTS() || curcpu->c_kmalloc == NULL) {
+		return NULL;
+	}
+	return &curcpu->c_kmalloc->kc_mags[blktype];
+}
+
+/*
+ * Allocate a bare block of type BLKTYPE, from the magazine if we can.
+ * Returns NULL if we're out of memory.
+ */
+static
+void *
+kmag_alloc(unsigned blktype)
+{
+	struct kmagazine *mag;
+	void *blocks[MAG_MAXROUNDS];
+	void *block;
+	unsigned n, i;
+	int spl;
+
+	spl = splhigh();
+	mag = kmag_get(blktype);
+	if (mag != NULL && mag->km_nrounds > 0) {
+		block = mag->km_rounds[--mag->km_nrounds];
+		splx(spl);
+		return block;
+	}
+	splx(spl);
+
+	/*
+	 * Refill. Do this with interrupts on, since getting a new page
+	 * may have to evict something, and then go back to whatever
+	 * cpu we're on now.
+	 */
+	n = subpage_getblocks(blktype, blocks,
+			      mag != NULL ? magbatch[blktype] : 1);
+	if (n == 0) {
+		return NULL;
+	}
+	block = blocks[--n];
+
+	spl = splhigh();
+	mag = kmag_get(blktype);
+	i = 0;
+	if (mag != NULL) {
+		while (i < n && mag->km_nrounds < MAG_MAXROUNDS) {
+			mag->km_rounds[mag->km_nrounds++] = blocks[i++];
+		}
+	}
+	splx(spl);
+
+	if (i < n) {
+		/* Somebody else filled it meanwhile. */
+		subpage_putblocks(&blocks[i], n - i);
+	}
+	return block;
+}
+
+/*
+ * Free the bare block BLOCK of type BLKTYPE into the magazine,
+ * sending some blocks back to the heap pages if it is full.
+ */
+static
+void
+kmag_free(unsigned blktype, void *block)
+{
+	struct kmagazine *mag;
+	void *blocks[MAG_MAXROUNDS];
+	unsigned n;
+	int spl;
+
+	spl = splhigh();
+	mag = kmag_get(blktype);
+	if (mag == NULL) {
+		splx(spl);
+		subpage_putblocks(&block, 1);
+		return;
+	}
+	n = 0;
+	if (mag->km_nrounds >= 2 * magbatch[blktype]) {
+		n = magbatch[blktype];
+		mag->km_nrounds -= n;
+		memcpy(blocks, &mag->km_rounds[mag->km_nrounds],
+		       n * sizeof(void *));
+	}
+	mag->km_rounds[mag->km_nrounds++] = block;
+	splx(spl);
+
+	if (n > 0) {
+		subpage_putblocks(blocks, n);
+	}
+}
+
+////////////////////////////////////////
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	void *retptr;		// our result
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+	sz = sizes[blktype];
+
+	retptr = kmag_alloc(blktype);
+	if (retptr == NULL) {
+		return NULL;
+	}
 
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+#endif
+	return retptr;
 }
 
 /*
@@ -1025,11 +1371,8 @@ subpage_kfree(void *ptr)
 {
 	int blktype;		// index into sizes[] that we're using
 	vaddr_t ptraddr;	// same as ptr
-	struct pageref *pr;	// pageref for page we're freeing in
-	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
+	struct pageref *pr;	// pageref for page we're freeing in
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
 #endif
@@ -1059,34 +1402,21 @@ subpage_kfree(void *ptr)
 	ptraddr -= LABEL_PTROFFSET;
 #endif
 
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
-	if (pr==NULL) {
+	/*
+	 * The block is allocated, so its page can't come or go under
+	 * us, and we can look up its type without the lock.
+	 */
+	pr = subpage_findpage(ptraddr);
+	if (pr == NULL) {
 		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
+	blktype = PR_BLOCKTYPE(pr);
 
-	offset = ptraddr - prpage;
+	offset = ptraddr % PAGE_SIZE;
 
-	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+	/* Check for proper alignment */
+	if (offset % sizes[blktype] != 0) {
 		panic("kfree: subpage free of invalid addr %p\n", ptr);
 	}
 
@@ -1104,45 +1434,10 @@ subpage_kfree(void *ptr)
 
 	/*
 	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
+	 * is already free. But that's expensive, so we don't. (For blocks
+	 * that go back on a freelist, subpage_putblocks checks the head.)
 	 */
-
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
-
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
-
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
-			}
-		}
-#else
-		/* check just the head */
-		KASSERT(fl != fl->next);
-#endif
-	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
-
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
-	}
+	kmag_free(blktype, (void *)ptraddr);
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -0,0 +1,258 @@
+/*
+ * Object caches. See kmem.h.
+ *
+ * Each slab is one page, with a struct kmem_slab at the start and the
+ * objects after it. Every object slot has a link word after the object
+ * proper, so a free object can sit on its slab's freelist without
+ * disturbing its constructed contents. Because slabs are page-aligned,
+ * the slab an object belongs to is found by rounding its address down.
+ *
+ * Slabs that have free objects are on kc_slabs; full ones are on
+ * kc_full. At most one entirely free slab is kept around so that an
+ * object allocated and freed over and over doesn't make and unmake a
+ * whole slab each time; other slabs are destroyed as soon as they
+ * become empty.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmem.h>
+
+struct kmem_slab {
+	struct kmem_slab *ks_next;	/* On kc_slabs or kc_full */
+	struct kmem_slab *ks_prev;
+	struct kmem_cache *ks_cache;	/* Cache we belong to */
+	void *ks_free;			/* Free objects */
+	unsigned ks_nfree;		/* Number of them */
+};
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_objsize;		/* Object size, rounded to a word */
+	size_t kc_slotsize;		/* Object plus link word, aligned */
+	unsigned kc_perslab;		/* Objects per slab */
+	int (*kc_ctor)(void *);
+	void (*kc_dtor)(void *);
+
+	/* Protects the rest. */
+	struct spinlock kc_lock;
+	struct kmem_slab *kc_slabs;	/* Slabs with free objects */
+	struct kmem_slab *kc_full;	/* Slabs without */
+	unsigned kc_nempty;		/* Entirely free slabs on kc_slabs */
+};
+
+/* Where objects start in a slab. */
+#define SLAB_HEADER  ROUNDUP(sizeof(struct kmem_slab), 8)
+
+/* The link word of a free object. */
+#define OBJ_LINK(kc, obj)  (*(void **)((char *)(obj) + (kc)->kc_objsize))
+
+#define OBJ_SLAB(obj)  ((struct kmem_slab *)((vaddr_t)(obj) & PAGE_FRAME))
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *), void (*dtor)(void *))
+{
+	struct kmem_cache *kc;
+
+	KASSERT(size > 0);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = name;
+	kc->kc_objsize = ROUNDUP(size, sizeof(void *));
+	kc->kc_slotsize = ROUNDUP(kc->kc_objsize + sizeof(void *), 8);
+	kc->kc_perslab = (PAGE_SIZE - SLAB_HEADER) / kc->kc_slotsize;
+	if (kc->kc_perslab == 0) {
+		panic("kmem_cache_create: %s: %zu-byte objects don't fit "
+		      "on a page\n", name, size);
+	}
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+
+	spinlock_init(&kc->kc_lock);
+	kc->kc_slabs = NULL;
+	kc->kc_full = NULL;
+	kc->kc_nempty = 0;
+
+	return kc;
+}
+
+/*
+ * Slab lists.
+ */
+static
+void
+slab_insert(struct kmem_slab **head, struct kmem_slab *ks)
+{
+	ks->ks_prev = NULL;
+	ks->ks_next = *head;
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks;
+	}
+	*head = ks;
+}
+
+static
+void
+slab_remove(struct kmem_slab **head, struct kmem_slab *ks)
+{
+	if (ks->ks_prev != NULL) {
+		ks->ks_prev->ks_next = ks->ks_next;
+	}
+	else {
+		KASSERT(*head == ks);
+		*head = ks->ks_next;
+	}
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks->ks_prev;
+	}
+}
+
+/*
+ * Destruct the first N objects of a slab and give the page back.
+ */
+static
+void
+slab_destroy(struct kmem_cache *kc, struct kmem_slab *ks, unsigned n)
+{
+	vaddr_t base;
+	unsigned i;
+
+	base = (vaddr_t)ks + SLAB_HEADER;
+	if (kc->kc_dtor != NULL) {
+		for (i = 0; i < n; i++) {
+			kc->kc_dtor((void *)(base + i * kc->kc_slotsize));
+		}
+	}
+	free_kpages((vaddr_t)ks);
+}
+
+/*
+ * Make a new slab full of constructed objects. Called without the
+ * cache lock, since the constructor may sleep.
+ */
+static
+struct kmem_slab *
+slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	vaddr_t base;
+	void *obj;
+	unsigned i;
+
+	base = alloc_kpages(1);
+	if (base == 0) {
+		return NULL;
+	}
+	ks = (struct kmem_slab *)base;
+	ks->ks_cache = kc;
+	ks->ks_free = NULL;
+	ks->ks_nfree = kc->kc_perslab;
+
+	base += SLAB_HEADER;
+	for (i = 0; i < kc->kc_perslab; i++) {
+		obj = (void *)(base + i * kc->kc_slotsize);
+		if (kc->kc_ctor != NULL && kc->kc_ctor(obj)) {
+			slab_destroy(kc, ks, i);
+			return NULL;
+		}
+		OBJ_LINK(kc, obj) = ks->ks_free;
+		ks->ks_free = obj;
+	}
+	return ks;
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+	while (kc->kc_slabs == NULL) {
+		spinlock_release(&kc->kc_lock);
+		ks = slab_create(kc);
+		if (ks == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&kc->kc_lock);
+		slab_insert(&kc->kc_slabs, ks);
+		kc->kc_nempty++;
+	}
+
+	ks = kc->kc_slabs;
+	KASSERT(ks->ks_nfree > 0);
+	if (ks->ks_nfree == kc->kc_perslab) {
+		KASSERT(kc->kc_nempty > 0);
+		kc->kc_nempty--;
+	}
+	obj = ks->ks_free;
+	ks->ks_free = OBJ_LINK(kc, obj);
+	ks->ks_nfree--;
+	if (ks->ks_nfree == 0) {
+		slab_remove(&kc->kc_slabs, ks);
+		slab_insert(&kc->kc_full, ks);
+	}
+	spinlock_release(&kc->kc_lock);
+
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks;
+
+	KASSERT(obj != NULL);
+	ks = OBJ_SLAB(obj);
+	KASSERT(ks->ks_cache == kc);
+	KASSERT(((vaddr_t)obj - (vaddr_t)ks - SLAB_HEADER)
+		% kc->kc_slotsize == 0);
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(ks->ks_nfree < kc->kc_perslab);
+	OBJ_LINK(kc, obj) = ks->ks_free;
+	ks->ks_free = obj;
+	ks->ks_nfree++;
+	if (ks->ks_nfree == 1) {
+		slab_remove(&kc->kc_full, ks);
+		slab_insert(&kc->kc_slabs, ks);
+	}
+	if (ks->ks_nfree == kc->kc_perslab) {
+		if (kc->kc_nempty > 0) {
+			/* We already have a spare. */
+			slab_remove(&kc->kc_slabs, ks);
+			spinlock_release(&kc->kc_lock);
+			slab_destroy(kc, ks, kc->kc_perslab);
+			return;
+		}
+		kc->kc_nempty++;
+	}
+	spinlock_release(&kc->kc_lock);
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+
+	if (kc->kc_full != NULL) {
+		panic("kmem_cache_destroy: %s: objects still in use\n",
+		      kc->kc_name);
+	}
+	while ((ks = kc->kc_slabs) != NULL) {
+		if (ks->ks_nfree != kc->kc_perslab) {
+			panic("kmem_cache_destroy: %s: objects still in use\n",
+			      kc->kc_name);
+		}
+		slab_remove(&kc->kc_slabs, ks);
+		slab_destroy(kc, ks, kc->kc_perslab);
+	}
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
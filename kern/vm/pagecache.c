@@ -0,0 +1,478 @@
+/*
+ * Page cache for file pages. See pagecache.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagecache.h>
+
+/* A cached page */
+struct pcpage {
+	struct vnode *pp_vn;		/* File (we hold a reference) */
+	off_t pp_offset;		/* Offset in the file */
+	paddr_t pp_pa;			/* Where it is */
+	unsigned pp_mappings;		/* Mappings not yet unmapped */
+	bool pp_busy;			/* Being written back */
+	bool pp_dirty;			/* Must be written back */
+	struct pcpage *pp_next;		/* Hash chain */
+};
+
+#define PC_NBUCKETS 64
+
+/*
+ * The hash table and everything in it is protected by pc_lock. Pages
+ * are also only added to or removed from the table, or written back,
+ * with vfs_biglock held. That way, whoever holds vfs_biglock (which
+ * includes file systems in the middle of a read or write) can look at
+ * a cached page's frame without worrying that it will be replaced or
+ * dropped, and a page that is busy is one the holder itself is
+ * writing back. vfs_biglock comes before pc_lock.
+ *
+ * Each vnode's vn_cachedpages counts its pages in the table. It is
+ * changed under both locks, so with vfs_biglock held it can be read
+ * without pc_lock, and a file with nothing cached skips the table.
+ */
+static struct pcpage *pc_table[PC_NBUCKETS];
+static struct lock *pc_lock;
+
+static
+unsigned
+pc_hash(struct vnode *vn, off_t offset)
+{
+	return ((uintptr_t)vn / sizeof(void *) + offset / PAGE_SIZE)
+		% PC_NBUCKETS;
+}
+
+static
+struct pcpage *
+pc_find(struct vnode *vn, off_t offset)
+{
+	struct pcpage *pp;
+
+	KASSERT(lock_do_i_hold(pc_lock));
+
+	for (pp = pc_table[pc_hash(vn, offset)]; pp != NULL; pp = pp->pp_next) {
+		if (pp->pp_vn == vn && pp->pp_offset == offset) {
+			return pp;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+pc_remove(struct pcpage *pp)
+{
+	struct pcpage **ppp;
+
+	KASSERT(lock_do_i_hold(pc_lock));
+
+	for (ppp = &pc_table[pc_hash(pp->pp_vn, pp->pp_offset)];
+	     *ppp != pp; ppp = &(*ppp)->pp_next) {
+		KASSERT(*ppp != NULL);
+	}
+	*ppp = pp->pp_next;
+	KASSERT(pp->pp_vn->vn_cachedpages > 0);
+	pp->pp_vn->vn_cachedpages--;
+}
+
+/*
+ * Count a new mapping of PP and hand back its frame with a coremap
+ * reference for the mapping.
+ */
+static
+void
+pc_map(struct pcpage *pp, paddr_t *ret)
+{
+	KASSERT(lock_do_i_hold(pc_lock));
+	KASSERT(!pp->pp_busy);
+
+	pp->pp_mappings++;
+	spinlock_acquire(&coremap_lock);
+	coremap_share(pp->pp_pa);
+	spinlock_release(&coremap_lock);
+	*ret = pp->pp_pa;
+}
+
+void
+pagecache_bootstrap(void)
+{
+	pc_lock = lock_create("pagecache");
+	if (pc_lock == NULL) {
+		panic("pagecache: out of memory\n");
+	}
+}
+
+/*
+ * Move one page between memory and the file. Short reads (past EOF)
+ * leave the rest of the page zero; writes are clipped to the current
+ * file size so that unmapping never grows the file.
+ */
+static
+int
+pc_io(struct pcpage *pp, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	struct stat st;
+	size_t len;
+	int result;
+
+	len = PAGE_SIZE;
+	if (rw == UIO_READ) {
+		bzero((void *)PADDR_TO_KVADDR(pp->pp_pa), PAGE_SIZE);
+	}
+	else {
+		result = VOP_STAT(pp->pp_vn, &st);
+		if (result) {
+			return result;
+		}
+		if (st.st_size <= pp->pp_offset) {
+			return 0;
+		}
+		if (st.st_size - pp->pp_offset < PAGE_SIZE) {
+			len = st.st_size - pp->pp_offset;
+		}
+	}
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pp->pp_pa), len,
+		  pp->pp_offset, rw);
+	if (rw == UIO_READ) {
+		return VOP_READ(pp->pp_vn, &ku);
+	}
+	return VOP_WRITE(pp->pp_vn, &ku);
+}
+
+int
+pagecache_get(struct vnode *vn, off_t offset, paddr_t *ret)
+{
+	struct pcpage *pp;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	/* Usually it is there already. */
+	lock_acquire(pc_lock);
+	pp = pc_find(vn, offset);
+	if (pp != NULL && !pp->pp_busy) {
+		pc_map(pp, ret);
+		lock_release(pc_lock);
+		return 0;
+	}
+	lock_release(pc_lock);
+
+	/*
+	 * Read it in. With vfs_biglock held nobody else can be partway
+	 * through reading it in or writing it back, so look again.
+	 */
+	vfs_biglock_acquire();
+	lock_acquire(pc_lock);
+	pp = pc_find(vn, offset);
+	if (pp != NULL) {
+		pc_map(pp, ret);
+		lock_release(pc_lock);
+		vfs_biglock_release();
+		return 0;
+	}
+	lock_release(pc_lock);
+
+	pp = kmalloc(sizeof(struct pcpage));
+	if (pp == NULL) {
+		vfs_biglock_release();
+		return ENOMEM;
+	}
+	pp->pp_pa = coremap_getupage(NULL, 0);
+	if (pp->pp_pa == 0) {
+		kfree(pp);
+		vfs_biglock_release();
+		return ENOMEM;
+	}
+	pp->pp_vn = vn;
+	pp->pp_offset = offset;
+	pp->pp_mappings = 1;
+	pp->pp_busy = false;
+	pp->pp_dirty = false;
+
+	/* Not in the table yet, so the file system reads the file. */
+	result = pc_io(pp, UIO_READ);
+
+	spinlock_acquire(&coremap_lock);
+	coremap_unbusy(pp->pp_pa);
+	if (result) {
+		coremap_freeupage(pp->pp_pa, NULL);
+		spinlock_release(&coremap_lock);
+		vfs_biglock_release();
+		kfree(pp);
+		return result;
+	}
+	/* One reference for the cache, one for the mapping. */
+	coremap_share(pp->pp_pa);
+	spinlock_release(&coremap_lock);
+
+	VOP_INCREF(vn);
+	lock_acquire(pc_lock);
+	pp->pp_next = pc_table[pc_hash(vn, offset)];
+	pc_table[pc_hash(vn, offset)] = pp;
+	vn->vn_cachedpages++;
+	*ret = pp->pp_pa;
+	lock_release(pc_lock);
+	vfs_biglock_release();
+	return 0;
+}
+
+void
+pagecache_ref(struct vnode *vn, off_t offset)
+{
+	struct pcpage *pp;
+
+	lock_acquire(pc_lock);
+	pp = pc_find(vn, offset);
+	KASSERT(pp != NULL && pp->pp_mappings > 0);
+	pp->pp_mappings++;
+	lock_release(pc_lock);
+}
+
+void
+pagecache_put(struct vnode *vn, off_t offset, bool dirty)
+{
+	struct pcpage *pp;
+	int result;
+
+	lock_acquire(pc_lock);
+	pp = pc_find(vn, offset);
+	KASSERT(pp != NULL && !pp->pp_busy);
+	KASSERT(pp->pp_mappings > 0);
+
+	if (dirty) {
+		pp->pp_dirty = true;
+	}
+	pp->pp_mappings--;
+	if (pp->pp_mappings > 0) {
+		lock_release(pc_lock);
+		return;
+	}
+	lock_release(pc_lock);
+
+	/*
+	 * That was the last mapping; drop the page, with vfs_biglock
+	 * held. It may have been mapped again, or even dropped by
+	 * someone else, while we didn't hold pc_lock, so look again.
+	 */
+	vfs_biglock_acquire();
+	lock_acquire(pc_lock);
+	pp = pc_find(vn, offset);
+	if (pp == NULL || pp->pp_mappings > 0) {
+		lock_release(pc_lock);
+		vfs_biglock_release();
+		return;
+	}
+
+	if (pp->pp_dirty) {
+		/*
+		 * Keep it in the table, busy, until it is written, so
+		 * nobody maps it meanwhile; they wait for vfs_biglock
+		 * and then read it back from the file.
+		 */
+		pp->pp_busy = true;
+		lock_release(pc_lock);
+		result = pc_io(pp, UIO_WRITE);
+		if (result) {
+			kprintf("pagecache: writeback failed: %s\n",
+				strerror(result));
+		}
+		lock_acquire(pc_lock);
+		pp->pp_busy = false;
+	}
+	pc_remove(pp);
+	lock_release(pc_lock);
+
+	spinlock_acquire(&coremap_lock);
+	coremap_freeupage(pp->pp_pa, NULL);
+	spinlock_release(&coremap_lock);
+	vfs_biglock_release();
+	VOP_DECREF(pp->pp_vn);
+	kfree(pp);
+}
+
+/*
+ * Do DOIO on VN with UIO cut short to LEN bytes.
+ */
+static
+int
+pc_doio(struct vnode *vn, struct uio *uio, size_t len,
+	int (*doio)(struct vnode *, struct uio *))
+{
+	size_t rest;
+	int result;
+
+	KASSERT(len <= uio->uio_resid);
+
+	rest = uio->uio_resid - len;
+	uio->uio_resid = len;
+	result = doio(vn, uio);
+	uio->uio_resid += rest;
+	return result;
+}
+
+/*
+ * Return the frame of the cached page of VN at OFFSET (page-aligned)
+ * if there is one that isn't being written back, else 0. Only good
+ * while the caller holds vfs_biglock.
+ */
+static
+paddr_t
+pc_lookup(struct vnode *vn, off_t offset)
+{
+	struct pcpage *pp;
+	paddr_t pa;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	lock_acquire(pc_lock);
+	pp = pc_find(vn, offset);
+	pa = (pp == NULL || pp->pp_busy) ? 0 : pp->pp_pa;
+	lock_release(pc_lock);
+	return pa;
+}
+
+/*
+ * Reads take cached pages from the cache, since they may have been
+ * written through a mapping, and everything else from the file.
+ */
+static
+int
+pc_read(struct vnode *vn, struct uio *uio,
+	int (*doio)(struct vnode *, struct uio *))
+{
+	struct stat st;
+	off_t pgoff, end;
+	paddr_t pa;
+	size_t skip, len, resid;
+	bool havesize;
+	int result;
+
+	if (vn->vn_cachedpages == 0) {
+		/* Pages our own faults read in meanwhile match the file. */
+		return doio(vn, uio);
+	}
+
+	havesize = false;
+	while (uio->uio_resid > 0) {
+		/* Find the first cached page in the rest of the range. */
+		end = uio->uio_offset + uio->uio_resid;
+		pgoff = uio->uio_offset - uio->uio_offset % PAGE_SIZE;
+		pa = 0;
+		for (; pgoff < end; pgoff += PAGE_SIZE) {
+			pa = pc_lookup(vn, pgoff);
+			if (pa != 0) {
+				break;
+			}
+		}
+
+		if (pgoff > uio->uio_offset) {
+			/* Read up to it from the file. */
+			len = (pgoff < end ? pgoff : end) - uio->uio_offset;
+			resid = uio->uio_resid;
+			result = pc_doio(vn, uio, len, doio);
+			if (result) {
+				return result;
+			}
+			if (resid - uio->uio_resid < len) {
+				/* EOF */
+				return 0;
+			}
+			continue;
+		}
+
+		/* Copy out of the cached page, stopping at EOF. */
+		if (!havesize) {
+			result = VOP_STAT(vn, &st);
+			if (result) {
+				return result;
+			}
+			havesize = true;
+		}
+		if (uio->uio_offset >= st.st_size) {
+			return 0;
+		}
+		skip = uio->uio_offset - pgoff;
+		len = PAGE_SIZE - skip;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		if (len > st.st_size - uio->uio_offset) {
+			len = st.st_size - uio->uio_offset;
+		}
+		result = uiomove((char *)PADDR_TO_KVADDR(pa) + skip, len, uio);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Writes go to the file, and then whatever part of them landed in
+ * cached pages is read back into those pages. That includes pages
+ * read in by our own faults on the user buffer while writing.
+ */
+static
+int
+pc_write(struct vnode *vn, struct uio *uio,
+	 int (*doio)(struct vnode *, struct uio *))
+{
+	struct iovec iov;
+	struct uio ku;
+	off_t start, pgoff, from, to;
+	paddr_t pa;
+	int result, result2;
+
+	start = uio->uio_offset;
+	result = doio(vn, uio);
+
+	/* Checked afterwards, so it includes pages read in meanwhile. */
+	if (vn->vn_cachedpages == 0) {
+		return result;
+	}
+	for (pgoff = start - start % PAGE_SIZE; pgoff < uio->uio_offset;
+	     pgoff += PAGE_SIZE) {
+		pa = pc_lookup(vn, pgoff);
+		if (pa == 0) {
+			continue;
+		}
+		from = pgoff < start ? start : pgoff;
+		to = pgoff + PAGE_SIZE;
+		if (to > uio->uio_offset) {
+			to = uio->uio_offset;
+		}
+		uio_kinit(&iov, &ku,
+			  (char *)PADDR_TO_KVADDR(pa) + (from - pgoff),
+			  to - from, from, UIO_READ);
+		result2 = doio(vn, &ku);
+		if (result2 && !result) {
+			result = result2;
+		}
+	}
+	return result;
+}
+
+int
+pagecache_rw(struct vnode *vn, struct uio *uio,
+	     int (*doio)(struct vnode *, struct uio *))
+{
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (uio->uio_rw == UIO_READ) {
+		return pc_read(vn, uio, doio);
+	}
+	return pc_write(vn, uio, doio);
+}
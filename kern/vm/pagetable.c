@@ -0,0 +1,210 @@
+/*
+ * Two-level page tables. See pagetable.h for the layout.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagetable.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(struct pagetable));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < PT_ENTRIES; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+/*
+ * Release whatever the entry PTE holds and zero it.
+ */
+static
+void
+pt_clear(pte_t *pte, struct addrspace *as)
+{
+	pte_t old;
+
+	if (*pte == 0) {
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	while (*pte & PTE_BUSY) {
+		coremap_wait();
+	}
+	old = *pte;
+	if (old & PTE_PRESENT) {
+		coremap_freeupage(old & PTE_FRAME, as);
+	}
+	*pte = 0;
+	spinlock_release(&coremap_lock);
+
+	if (old & PTE_SWAPPED) {
+		swap_free(PTE_SLOT(old));
+	}
+}
+
+void
+pt_destroy(struct pagetable *pt, struct addrspace *as)
+{
+	unsigned i, j;
+	pte_t *l2;
+
+	for (i = 0; i < PT_ENTRIES; i++) {
+		l2 = pt->pt_dir[i];
+		if (l2 == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_ENTRIES; j++) {
+			pt_clear(&l2[j], as);
+		}
+		/* Nothing in it now, so the evictor won't look here. */
+		kfree(l2);
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	pte_t *l2;
+	unsigned i;
+
+	l2 = pt->pt_dir[PT_L1_INDEX(vaddr)];
+	if (l2 == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		l2 = kmalloc(PAGE_SIZE);
+		if (l2 == NULL) {
+			return NULL;
+		}
+		for (i = 0; i < PT_ENTRIES; i++) {
+			l2[i] = 0;
+		}
+		/* Make sure the zeroes are visible before the table is. */
+		membar_store_store();
+		pt->pt_dir[PT_L1_INDEX(vaddr)] = l2;
+	}
+	return &l2[PT_L2_INDEX(vaddr)];
+}
+
+void
+pt_unmap(struct pagetable *pt, struct addrspace *as, vaddr_t start,
+	 vaddr_t end)
+{
+	vaddr_t va;
+	pte_t *pte;
+
+	KASSERT(start % PAGE_SIZE == 0);
+	KASSERT(end % PAGE_SIZE == 0);
+
+	for (va = start; va < end; va += PAGE_SIZE) {
+		pte = pt_lookup(pt, va, false);
+		if (pte == NULL) {
+			/* Skip the rest of this second-level table. */
+			va = PT_VADDR(PT_L1_INDEX(va) + 1, 0) - PAGE_SIZE;
+			if (va + PAGE_SIZE == 0) {
+				break;
+			}
+			continue;
+		}
+		pt_clear(pte, as);
+	}
+}
+
+/*
+ * Read the page OLD refers to back from swap into a new page for
+ * NEWAS, and point NEWPTE at it.
+ */
+static
+int
+pt_copyswapped(pte_t old, pte_t *newpte, struct addrspace *newas, vaddr_t va)
+{
+	paddr_t pa;
+	int result;
+
+	pa = coremap_getupage(newas, va);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	result = swap_in(PTE_SLOT(old), pa);
+
+	spinlock_acquire(&coremap_lock);
+	coremap_unbusy(pa);
+	if (result) {
+		coremap_freeupage(pa, newas);
+	}
+	else {
+		*newpte = pa | PTE_PRESENT;
+	}
+	spinlock_release(&coremap_lock);
+
+	return result;
+}
+
+int
+pt_copy(struct pagetable *old, struct pagetable *new, struct addrspace *newas)
+{
+	unsigned i, j;
+	pte_t *oldl2, *newpte, pte;
+	int result;
+
+	for (i = 0; i < PT_ENTRIES; i++) {
+		oldl2 = old->pt_dir[i];
+		if (oldl2 == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_ENTRIES; j++) {
+			if (oldl2[j] == 0) {
+				continue;
+			}
+			newpte = pt_lookup(new, PT_VADDR(i, j), true);
+			if (newpte == NULL) {
+				return ENOMEM;
+			}
+
+			spinlock_acquire(&coremap_lock);
+			while (oldl2[j] & PTE_BUSY) {
+				coremap_wait();
+			}
+			pte = oldl2[j];
+			if (pte & PTE_PRESENT) {
+				coremap_share(pte & PTE_FRAME);
+				if ((pte & PTE_SHARED) == 0) {
+					oldl2[j] |= PTE_COW;
+				}
+				*newpte = oldl2[j] & ~PTE_DIRTY;
+				spinlock_release(&coremap_lock);
+				continue;
+			}
+			spinlock_release(&coremap_lock);
+
+			/*
+			 * Swapped out. Only OLD's owner changes a swapped
+			 * entry, and the caller holds its lock, so it stays
+			 * put while we read it in.
+			 */
+			KASSERT(pte & PTE_SWAPPED);
+			result = pt_copyswapped(pte, newpte, newas,
+						PT_VADDR(i, j));
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
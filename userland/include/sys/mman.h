@@ -0,0 +1,23 @@
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+/*
+ * Memory mapping.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <kern/mman.h>
+
+/* Returned by mmap on failure. */
+#define MAP_FAILED ((void *)-1)
+
+/*
+ * ADDR is only a hint and is currently ignored. OFFSET must be a
+ * multiple of the page size. MAP_ANON mappings must be MAP_PRIVATE.
+ * munmap must cover whole mappings.
+ */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t len);
+
+#endif /* _SYS_MMAN_H_ */
@@ -0,0 +1,20 @@
+#ifndef _SYS_UIO_H_
+#define _SYS_UIO_H_
+
+/*
+ * Scatter/gather I/O.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <kern/iovec.h>
+
+/*
+ * Read into or write from the IOVCNT buffers described by IOV, in
+ * order, as one operation at the file's current offset. IOVCNT must be
+ * between 1 and IOV_MAX.
+ */
+ssize_t readv(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t writev(int filehandle, const struct iovec *iov, int iovcnt);
+
+#endif /* _SYS_UIO_H_ */
@@ -0,0 +1,232 @@
+/*
+ * mmaptest - check that read() and write() agree with a live
+ * MAP_SHARED mapping of the same file.
+ *
+ * Usage: mmaptest [filename]
+ *
+ * The file (default "mmapfile") is created, mapped, and then poked at
+ * both through the mapping and with read/write while the mapping is
+ * still there, and across fork. Run it on SFS.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <errno.h>
+
+#define TESTFILE "mmapfile"
+
+/* Two pages' worth. */
+#define FILESIZE 8192
+
+static char buf[FILESIZE];
+
+static
+void
+fill(char *p, size_t len, char c)
+{
+	memset(p, c, len);
+}
+
+/*
+ * Check that LEN bytes at P are all C.
+ */
+static
+void
+check(const char *what, const char *p, size_t len, char c)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (p[i] != c) {
+			errx(1, "%s: byte %zu is '%c', expected '%c'",
+			     what, i, p[i], c);
+		}
+	}
+}
+
+static
+void
+dopwrite(int fd, const char *p, size_t len, off_t pos)
+{
+	ssize_t r;
+
+	r = pwrite(fd, p, len, pos);
+	if (r < 0) {
+		err(1, "pwrite");
+	}
+	if ((size_t)r != len) {
+		errx(1, "pwrite: wrote %zd of %zu bytes", r, len);
+	}
+}
+
+static
+void
+dopread(int fd, char *p, size_t len, off_t pos)
+{
+	ssize_t r;
+
+	r = pread(fd, p, len, pos);
+	if (r < 0) {
+		err(1, "pread");
+	}
+	if ((size_t)r != len) {
+		errx(1, "pread: read %zd of %zu bytes", r, len);
+	}
+}
+
+/*
+ * Run FUNC(ARG) in a child process and wait for it to succeed.
+ */
+static
+void
+inchild(void (*func)(char *), char *arg)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		func(arg);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+}
+
+static
+void
+childstore(char *p)
+{
+	check("child's view of mapping", p, 10, 'b');
+	fill(p, 10, 'e');
+}
+
+/*
+ * A shared file mapping stays shared with a child; private anonymous
+ * memory doesn't; shared anonymous memory is refused.
+ */
+static
+void
+forktest(int fd)
+{
+	char *map, *anon;
+
+	map = mmap(NULL, FILESIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	check("mapping before fork", map + 10, 10, 'b');
+	inchild(childstore, map + 10);
+	check("mapping after child's store", map + 10, 10, 'e');
+	if (munmap(map, FILESIZE) < 0) {
+		err(1, "munmap");
+	}
+	dopread(fd, buf, 10, 10);
+	check("file after child's store", buf, 10, 'e');
+
+	anon = mmap(NULL, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON,
+		    -1, 0);
+	if (anon == MAP_FAILED) {
+		err(1, "mmap anon");
+	}
+	fill(anon, 10, 'b');
+	inchild(childstore, anon);
+	check("private memory after child's store", anon, 10, 'b');
+	if (munmap(anon, 4096) < 0) {
+		err(1, "munmap anon");
+	}
+
+	anon = mmap(NULL, 4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON,
+		    -1, 0);
+	if (anon != MAP_FAILED) {
+		errx(1, "mmap of shared anonymous memory succeeded");
+	}
+	if (errno != EINVAL) {
+		err(1, "mmap of shared anonymous memory");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *filename;
+	char *map;
+	int fd;
+
+	filename = argc > 1 ? argv[1] : TESTFILE;
+
+	fd = open(filename, O_RDWR|O_CREAT|O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s", filename);
+	}
+	fill(buf, FILESIZE, 'a');
+	dopwrite(fd, buf, FILESIZE, 0);
+
+	map = mmap(NULL, FILESIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	check("initial mapping", map, FILESIZE, 'a');
+
+	/* write() to pages the mapping has in the cache. */
+	fill(buf, 100, 'b');
+	dopwrite(fd, buf, 100, 10);
+	check("mapping after write", map + 10, 100, 'b');
+	check("mapping around write", map + 110, FILESIZE - 110, 'a');
+
+	/* Stores through the mapping, seen by read(). */
+	fill(map + 4096, 50, 'c');
+	dopread(fd, buf, FILESIZE, 0);
+	check("read after store", buf + 4096, 50, 'c');
+	check("read of written range", buf + 10, 100, 'b');
+
+	/*
+	 * A write() over part of a page stored to through the mapping
+	 * wins for the bytes it covers; the rest keep the stores.
+	 */
+	fill(buf, 20, 'd');
+	dopwrite(fd, buf, 20, 4096 + 40);
+	check("mapping after overwrite", map + 4096, 40, 'c');
+	check("mapping after overwrite", map + 4096 + 40, 20, 'd');
+
+	/*
+	 * Unmapping writes back the page that was stored to. The first
+	 * page was only read through the mapping, so it is not written
+	 * back over what write() put there.
+	 */
+	if (munmap(map, FILESIZE) < 0) {
+		err(1, "munmap");
+	}
+	dopread(fd, buf, FILESIZE, 0);
+	check("file after munmap", buf, 10, 'a');
+	check("file after munmap", buf + 10, 100, 'b');
+	check("file after munmap", buf + 110, 4096 - 110, 'a');
+	check("file after munmap", buf + 4096, 40, 'c');
+	check("file after munmap", buf + 4096 + 40, 20, 'd');
+	check("file after munmap", buf + 4096 + 60, 4096 - 60, 'a');
+
+	forktest(fd);
+
+	if (close(fd) < 0) {
+		err(1, "close");
+	}
+	if (remove(filename) < 0) {
+		err(1, "remove %s", filename);
+	}
+
+	printf("mmaptest: passed\n");
+	return 0;
+}